@@ -0,0 +1,265 @@
+#include "Crusher.h"
+#include "FileUtils.h"
+#include "OutputGenerator.h"
+#include "ShaderDedup.h"
+#include "ShaderUtils.h"
+#include "ThreadPool.h"
+#include "Unpacker.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_set>
+
+// Function to build a Huffman code for the bytes of the compressed shaders, including their terminating NUL
+static HuffmanCode buildEntropyCode(const std::unordered_map<std::string, std::string>& shaders) {
+	std::array<size_t, 256> frequencies{};
+	for (const auto& [path, text] : shaders) {
+		for (char c : text) frequencies[(uint8_t)c]++;
+		frequencies[0]++;
+	}
+	return build_huffman_code(frequencies);
+}
+
+Crusher::Crusher(const CrusherOptions& options) : options(options) {
+	if (options.maxTokenSize != 0 && options.maxTokenSize < options.minTokenSize) {
+		throw std::runtime_error("Error: --max-token-size must be greater than or equal to --min-token-size.");
+	}
+}
+
+// Function to add a shader, or replace the one with the same name. It is validated and processed by the next job.
+void Crusher::setShader(const std::string& name, std::string_view source) {
+	Shader& shader = sources[name];
+	shader.code = source;
+	shader.sourceSize = source.size();
+	shader.processed = false;
+	shader.renamed = false;
+}
+
+// Function to process the shaders set since the previous job: they are validated and their version and externals extracted in parallel,
+// the externals of every shader are then given global names, and the shaders renamed with them in parallel
+void Crusher::processShaders(ThreadPool& pool, std::vector<PhaseStats>& phases) {
+	std::vector<std::pair<const std::string*, Shader*>> pending;
+	for (auto& [name, shader] : sources) {
+		if (!shader.processed) pending.emplace_back(&name, &shader);
+	}
+	std::sort(pending.begin(), pending.end(), [](const auto& a, const auto& b) { return *a.first < *b.first; });
+
+	if (options.verbose) {
+		for (const auto& [name, shader] : pending) std::cout << "Processing shader: " << *name << "\n";
+	}
+
+	PhaseTimer frontEndPhase(phases, "front-end");
+	pool.run(pending.size(), [&](size_t i) {
+		const std::string& name = *pending[i].first;
+		Shader& shader = *pending[i].second;
+
+		size_t nonASCII = findNonASCII(shader.code);
+		if (nonASCII != std::string_view::npos) {
+			throw std::runtime_error("Non-ASCII character detected at byte " + std::to_string(nonASCII) + " in shader " + name);
+		}
+
+		// Extract and validate version
+		shader.version = extractGLSLVersion(shader.code);
+		if (shader.version > 0 && options.maxGLSLVersion > 0 && shader.version > options.maxGLSLVersion) {
+			throw std::runtime_error("Error: Shader " + name + " uses GLSL version " + std::to_string(shader.version) + ", which exceeds the specified maximum version " + std::to_string(options.maxGLSLVersion) + ".");
+		}
+		removeGLSLVersionDirective(shader.code);
+
+		shader.externals = collectExternals(shader.code);
+		shader.processed = true;
+	});
+	frontEndPhase.stop();
+
+	// Names already given are kept, by the shared dictionary first, then by the previous job or, before the first one, by
+	// the dictionary cache, so that an edit does not renumber the externals of every shader and invalidate the dictionary.
+	// Only the externals seen for the first time are ranked, which does not depend on the order of the shaders or on
+	// the thread count.
+	PhaseTimer assignmentPhase(phases, "symbol assignment");
+	std::vector<const ShaderExternals*> externals;
+	for (const auto& [name, shader] : sources) externals.push_back(&shader.externals);
+
+	std::unordered_map<std::string, std::string> uniformMap;
+	std::unordered_map<std::string, std::string> inOutMap;
+	auto keep = [](std::unordered_map<std::string, std::string>& map, const std::unordered_map<std::string, std::string>& names) {
+		std::unordered_set<std::string> used;
+		for (const auto& [name, global] : map) used.insert(global);
+		std::vector<std::pair<std::string, std::string>> sorted(names.begin(), names.end());
+		std::sort(sorted.begin(), sorted.end());
+		for (const auto& [name, global] : sorted) {
+			if (!map.count(name) && used.insert(global).second) map.emplace(name, global);
+		}
+	};
+	if (sharedDictionary) {
+		keep(uniformMap, sharedDictionary->uniformNames);
+		keep(inOutMap, sharedDictionary->inOutNames);
+	}
+	bool firstJob = shaders.empty();
+	keep(uniformMap, firstJob ? cache.uniform_names : globalUniformMap);
+	keep(inOutMap, firstJob ? cache.in_out_names : globalInOutMap);
+
+	// Names are only kept for the externals of these shaders
+	auto keepDeclared = [&](std::unordered_map<std::string, std::string>& map, std::vector<std::string> ShaderExternals::* declared) {
+		std::unordered_map<std::string, std::string> kept;
+		for (const ShaderExternals* shader : externals) {
+			for (const std::string& name : shader->*declared) {
+				auto it = map.find(name);
+				if (it != map.end()) kept.emplace(name, it->second);
+			}
+		}
+		map = std::move(kept);
+	};
+	keepDeclared(uniformMap, &ShaderExternals::uniforms);
+	keepDeclared(inOutMap, &ShaderExternals::inOuts);
+	assignExternalNames(externals, uniformMap, inOutMap, options.verbose);
+	assignmentPhase.stop();
+
+	// Renaming the shaders not processed again is only needed when the global names changed
+	std::vector<std::pair<const std::string*, Shader*>> renamed;
+	bool namesChanged = uniformMap != globalUniformMap || inOutMap != globalInOutMap;
+	for (auto& [name, shader] : sources) {
+		bool inserted = shaders.try_emplace(name).second;
+		if (inserted || namesChanged || !shader.renamed) renamed.emplace_back(&name, &shader);
+	}
+	globalUniformMap = std::move(uniformMap);
+	globalInOutMap = std::move(inOutMap);
+
+	PhaseTimer renamingPhase(phases, "externals renaming");
+	pool.run(renamed.size(), [&](size_t i) {
+		shaders.at(*renamed[i].first) = renameExternals(renamed[i].second->code, globalUniformMap, globalInOutMap, options.verbose);
+		renamed[i].second->renamed = true;
+	});
+}
+
+// Function to compress the shaders and generate the pack, header and C source
+CrusherResult Crusher::crush() {
+	if (sources.empty()) {
+		throw std::runtime_error("Error: No shader files provided.");
+	}
+
+	CrusherResult result;
+	std::vector<PhaseStats>& phases = result.stats.phases;
+
+	ThreadPool pool(options.threads);
+	processShaders(pool, phases);
+
+	// Determine the GLSL version to use
+	int highestGLSLVersion = 0;
+	for (const auto& [name, shader] : sources) highestGLSLVersion = std::max(highestGLSLVersion, shader.version);
+	int glslVersion = options.maxGLSLVersion > 0 ? options.maxGLSLVersion : highestGLSLVersion;
+
+	if (options.verbose) {
+		std::cout << "Highest GLSL version detected: " << highestGLSLVersion << std::endl;
+		std::cout << "Using GLSL version: " << glslVersion << std::endl;
+	}
+
+	// Identical shaders are compressed once, near-duplicates as the prefix and suffix they share and their own middle.
+	// The pieces are compressed in place, the processed shaders are kept for the next job.
+	PhaseTimer dedupPhase(phases, "dedup");
+	ShaderDedup dedup;
+	std::unordered_map<std::string, std::string> texts = dedup_texts(shaders, dedup);
+	dedupPhase.stop();
+
+	if (options.verbose) {
+		size_t members = 0;
+		for (const DeltaGroup& group : dedup.groups) members += group.members.size();
+		std::cout << "Dedup: " << dedup.aliases.size() << " identical shaders, " << members << " near-duplicates in " << dedup.groups.size() << " groups" << std::endl;
+	}
+
+	PhaseTimer searchPhase(phases, sharedDictionary ? "dictionary encoding" : "token search");
+	if (sharedDictionary) {
+		std::vector<std::string*> encoded;
+		for (auto& [name, text] : texts) encoded.push_back(&text);
+		pool.run(encoded.size(), [&](size_t i) {
+			encode_text(*encoded[i], sharedDictionary->tokens);
+		});
+		result.tokens = sharedDictionary->tokens;
+		result.tokens.stats = CompressionStats();
+	}
+	else if (options.reuseDictionary) {
+		result.tokens = compress_with_cache(texts, cache, options.dictionaryThresholdPercent, options.minTokenSize, options.maxTokenSize, pool, options.budget, options.beamWidth, options.verbose, result.dictionaryUpdated, result.dictionaryStats.emplace());
+		// The names the dictionary was found for are cached with it, for the next process to keep them
+		if (cache.uniform_names != globalUniformMap || cache.in_out_names != globalInOutMap) {
+			cache.uniform_names = globalUniformMap;
+			cache.in_out_names = globalInOutMap;
+			result.dictionaryUpdated = true;
+		}
+	}
+	else {
+		result.tokens = compress_texts(texts, options.minTokenSize, options.maxTokenSize, pool, options.budget, options.beamWidth, options.verbose);
+	}
+	searchPhase.stop();
+
+	// The shared prefixes and suffixes become tokens of the pack only, the dictionary found is kept as is
+	Tokens tokens = result.tokens;
+	texts = assemble_texts(texts, dedup, tokens);
+
+	// Pass the GLSL version to the header generator
+	std::string glslVersionDirective = "#version " + std::to_string(glslVersion) + (options.useCoreVersion ? " core" : "");
+	std::vector<std::pair<std::string, size_t>> shadersOffsets;
+	std::vector<size_t> shaderLengths;
+
+	// Compute the expanded length of every token, stored in the pack along with the exact length of every shader
+	PhaseTimer packingPhase(phases, "packing");
+	TokenExpansion expansion = expandTokens(tokens.token_char_map, tokens.token_list);
+
+	result.pack = generatePackedContent(texts, tokens.token_char_map, tokens.token_list, expansion, glslVersionDirective, nullptr, shadersOffsets, shaderLengths, dedup.aliases);
+
+	packingPhase.stop();
+
+	// Optionally entropy code the shaders, checking they still unpack to the same sources
+	if (options.entropy) {
+		PhaseTimer entropyPhase(phases, "entropy coding");
+		result.entropyCode = buildEntropyCode(texts);
+		result.plainPack = std::move(result.pack);
+		shadersOffsets.clear();
+		shaderLengths.clear();
+		result.pack = generatePackedContent(texts, tokens.token_char_map, tokens.token_list, expansion, glslVersionDirective, &*result.entropyCode, shadersOffsets, shaderLengths, dedup.aliases);
+
+		HuffmanDecoder decoder = make_huffman_decoder(*result.entropyCode);
+		if (unpack_shaders(result.plainPack, nullptr) != unpack_shaders(result.pack, &decoder)) {
+			throw std::runtime_error("Error: Entropy coded shaders do not unpack to the original shaders.");
+		}
+	}
+
+	// Optionally unpack every shader of the pack like the generated decompressor, comparing it byte for byte with its renamed source
+	if (options.verify) {
+		PhaseTimer verificationPhase(phases, "verification");
+		std::optional<HuffmanDecoder> decoder;
+		if (result.entropyCode) decoder = make_huffman_decoder(*result.entropyCode);
+		std::vector<std::string> unpacked = unpack_shaders(result.pack, decoder ? &*decoder : nullptr);
+
+		for (size_t i = 0; i < unpacked.size(); i++) {
+			const std::string& name = shadersOffsets[i].first;
+			std::string expected = glslVersionDirective + "\n" + shaders.at(name);
+			if (unpacked[i] != expected) {
+				auto mismatch = std::mismatch(unpacked[i].begin(), unpacked[i].end(), expected.begin(), expected.end());
+				throw std::runtime_error("Error: Shader " + name + " does not unpack to its renamed source, from byte " + std::to_string(mismatch.first - unpacked[i].begin()) + ".");
+			}
+		}
+	}
+
+	PhaseTimer codegenPhase(phases, "codegen");
+	RuntimeOptions runtime;
+	runtime.embeddedPack = options.embed ? &result.pack : nullptr;
+	runtime.cachedShaders = options.cachedAccessor ? shadersOffsets.size() : 0;
+	result.header = generateHeader(globalUniformMap, shadersOffsets, shaderLengths, runtime);
+	result.cFile = generateCFile(globalUniformMap, expansion.maxDepth, result.entropyCode ? &*result.entropyCode : nullptr, runtime);
+	codegenPhase.stop();
+
+	// Report each token found, and the size of each shader compressed against the dictionary
+	result.stats.tokens = tokens.stats.iterations;
+	for (const auto& [name, text] : texts) {
+		result.stats.shaders.push_back({name, sources.at(name).sourceSize, text.size()});
+	}
+	for (const auto& [name, stored] : dedup.aliases) {
+		result.stats.shaders.push_back({name, sources.at(name).sourceSize, 0});
+	}
+	std::sort(result.stats.shaders.begin(), result.stats.shaders.end(), [](const ShaderStats& a, const ShaderStats& b) { return a.name < b.name; });
+	for (const auto& [value, token] : tokens.token_char_map) result.stats.dictionary_size += token.size() + TOKEN_STORAGE_COST;
+	for (const auto& [index, token] : tokens.token_list) result.stats.dictionary_size += token.size() + TOKEN_STORAGE_COST;
+	result.stats.pack_size = result.pack.size();
+
+	return result;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "DictionaryCache.h"
+#include "Entropy.h"
+#include "ShaderUtils.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "Token.h"
+
+// Settings of a compression job
+struct CrusherOptions {
+	int maxGLSLVersion = 0; // 0 uses the highest version found in the shaders
+	bool useCoreVersion = true;
+	size_t minTokenSize = 3;
+	size_t maxTokenSize = 0;
+	size_t threads = 1;
+	CompressionBudget budget;
+	size_t beamWidth = 1; // Best tokens compared by looking a few replacements ahead, 1 choosing greedily
+	bool entropy = false;
+	bool embed = false; // Embed the pack in the C file
+	bool cachedAccessor = false; // Generate getShaderSource, unpacking each shader once
+	bool verify = false; // Unpack every shader of the pack and compare it with its renamed source
+	// Encode with the dictionary of the previous job, or the one given, while it compresses the shaders
+	// no more than dictionaryThresholdPercent worse than when it was found
+	bool reuseDictionary = false;
+	double dictionaryThresholdPercent = 5.0;
+	bool verbose = false;
+};
+
+// Outputs of a compression job
+struct CrusherResult {
+	std::vector<uint8_t> pack;
+	std::string header;
+	std::string cFile;
+	std::vector<uint8_t> plainPack;           // The pack without entropy coding, only set with entropy coding
+	std::optional<HuffmanCode> entropyCode;
+	Tokens tokens;
+	bool dictionaryUpdated = false;           // Whether dictionary() changed, for callers keeping it in a cache file
+	std::optional<DictionaryCacheStats> dictionaryStats; // What the job did with the dictionary, set with reuseDictionary
+	JobStats stats;
+};
+
+// Packs a set of shaders in memory. Shaders are processed by the next job once set, so that only changed ones are
+// processed again between jobs, on options.threads threads. A Crusher holds no shared state: independent instances
+// can be used from different threads.
+class Crusher {
+public:
+	explicit Crusher(const CrusherOptions& options = CrusherOptions());
+
+	void setShader(const std::string& name, std::string_view source);
+
+	CrusherResult crush();
+
+	const DictionaryCache& dictionary() const { return cache; }
+	void setDictionary(DictionaryCache dictionary) { cache = std::move(dictionary); }
+
+	// Encodes the shaders with a fixed dictionary instead of searching tokens, ignoring reuseDictionary.
+	// Externals named in the dictionary keep their name there.
+	void setSharedDictionary(SharedDictionary dictionary) { sharedDictionary = std::move(dictionary); }
+
+	// Global names of the externals of the shaders, as of the last job
+	const std::unordered_map<std::string, std::string>& uniformNames() const { return globalUniformMap; }
+	const std::unordered_map<std::string, std::string>& inOutNames() const { return globalInOutMap; }
+
+private:
+	// A shader as set, and what processing it found
+	struct Shader {
+		std::string code;  // Without its version directive once processed
+		size_t sourceSize = 0;
+		int version = 0;
+		ShaderExternals externals;
+		bool processed = false;
+		bool renamed = false;
+	};
+
+	void processShaders(ThreadPool& pool, std::vector<PhaseStats>& phases);
+
+	CrusherOptions options;
+	std::unordered_map<std::string, Shader> sources;
+	std::unordered_map<std::string, std::string> shaders; // Renamed shaders by name
+	std::unordered_map<std::string, std::string> globalUniformMap;
+	std::unordered_map<std::string, std::string> globalInOutMap;
+	DictionaryCache cache;
+	std::optional<SharedDictionary> sharedDictionary;
+};
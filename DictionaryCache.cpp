@@ -0,0 +1,273 @@
+#include "DictionaryCache.h"
+#include "FileUtils.h"
+
+#include <algorithm>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+// Cache files start with "GLCD" and their format version, then hold the settings the dictionary was found with (token sizes and beam width),
+// the sizes it compressed the texts to, the dictionary, the encoding of every text by hash of the text, and the global names of their externals
+static constexpr uint32_t CACHE_MAGIC = 0x44434C47;
+static constexpr uint32_t CACHE_FORMAT = 3;
+
+// Shared dictionary files start with "GLSD" and their format version, then only hold the dictionary
+static constexpr uint32_t SHARED_DICTIONARY_MAGIC = 0x44534C47;
+static constexpr uint32_t SHARED_DICTIONARY_FORMAT = 1;
+
+// 64-bit FNV-1a hash of a text, identifying it in the cache
+static uint64_t text_hash(const std::string& text) {
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : text) {
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Size of compressed texts, each token costing its content and its storage
+static uint64_t compressed_size(const std::unordered_map<std::string, std::string>& texts, const Tokens& tokens) {
+	uint64_t size = 0;
+	for (const auto& [name, text] : texts) size += text.size();
+	for (const auto& [value, token] : tokens.token_char_map) size += token.size() + TOKEN_STORAGE_COST;
+	for (const auto& [index, token] : tokens.token_list) size += token.size() + TOKEN_STORAGE_COST;
+	return size;
+}
+
+static void write_u64(std::string& out, uint64_t value) {
+	for (int i = 0; i < 8; i++) out += static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+static void write_string(std::string& out, const std::string& value) {
+	write_u64(out, value.size());
+	out += value;
+}
+
+// Reads the cache file content, throwing if it is truncated
+struct CacheReader {
+	std::string_view data;
+	size_t pos = 0;
+
+	uint64_t u64() {
+		if (data.size() - pos < 8) throw std::runtime_error("truncated");
+		uint64_t value = 0;
+		for (int i = 0; i < 8; i++) value |= (uint64_t)static_cast<uint8_t>(data[pos + i]) << (8 * i);
+		pos += 8;
+		return value;
+	}
+
+	std::string string() {
+		uint64_t size = u64();
+		if (data.size() - pos < size) throw std::runtime_error("truncated");
+		pos += size;
+		return std::string(data.substr(pos - size, size));
+	}
+};
+
+static void write_tokens(std::string& out, const Tokens& tokens) {
+	write_u64(out, tokens.token_char_map.size());
+	for (size_t i = 0; i < tokens.token_char_map.size(); i++) write_string(out, tokens.token_char_map.at((uint8_t)(128 + i)));
+	write_u64(out, tokens.token_list.size());
+	for (size_t i = 0; i < tokens.token_list.size(); i++) write_string(out, tokens.token_list.at((uint16_t)i));
+}
+
+static void read_tokens(CacheReader& reader, Tokens& tokens) {
+	uint64_t charTokens = reader.u64();
+	if (charTokens > 128) throw std::runtime_error("char tokens");
+	for (uint64_t i = 0; i < charTokens; i++) tokens.token_char_map[(uint8_t)(128 + i)] = reader.string();
+
+	uint64_t listTokens = reader.u64();
+	if (listTokens > 65536) throw std::runtime_error("tokens");
+	for (uint64_t i = 0; i < listTokens; i++) tokens.token_list[(uint16_t)i] = reader.string();
+}
+
+// Names are written sorted, so that the same dictionary always gives the same file
+static void write_names(std::string& out, const std::unordered_map<std::string, std::string>& names) {
+	std::vector<std::pair<std::string, std::string>> sorted(names.begin(), names.end());
+	std::sort(sorted.begin(), sorted.end());
+
+	write_u64(out, sorted.size());
+	for (const auto& [name, global] : sorted) {
+		write_string(out, name);
+		write_string(out, global);
+	}
+}
+
+static void read_names(CacheReader& reader, std::unordered_map<std::string, std::string>& names) {
+	uint64_t count = reader.u64();
+	for (uint64_t i = 0; i < count; i++) {
+		std::string name = reader.string();
+		names[name] = reader.string();
+	}
+}
+
+// Function to load a cache file, returns false if there is none or it cannot be used
+bool load_dictionary_cache(const std::string& path, DictionaryCache& cache) {
+	std::optional<MappedFile> file;
+	try {
+		file.emplace(path);
+	} catch (const std::runtime_error&) {
+		return false;
+	}
+
+	try {
+		CacheReader reader{file->view()};
+		if (reader.u64() != (((uint64_t)CACHE_FORMAT << 32) | CACHE_MAGIC)) throw std::runtime_error("format");
+
+		cache.min_token_size = reader.u64();
+		cache.max_token_size = reader.u64();
+		cache.beam_width = reader.u64();
+		cache.original_size = reader.u64();
+		cache.compressed_size = reader.u64();
+
+		read_tokens(reader, cache.tokens);
+
+		uint64_t entries = reader.u64();
+		for (uint64_t i = 0; i < entries; i++) {
+			uint64_t hash = reader.u64();
+			cache.encoded[hash] = reader.string();
+		}
+
+		read_names(reader, cache.uniform_names);
+		read_names(reader, cache.in_out_names);
+	} catch (const std::exception&) {
+		std::cerr << "Warning: Ignoring invalid dictionary cache " << path << std::endl;
+		cache = DictionaryCache();
+		return false;
+	}
+
+	return true;
+}
+
+// Function to save a cache file, replacing the previous one only once the new one is complete
+void save_dictionary_cache(const std::string& path, const DictionaryCache& cache) {
+	std::string out;
+	write_u64(out, ((uint64_t)CACHE_FORMAT << 32) | CACHE_MAGIC);
+	write_u64(out, cache.min_token_size);
+	write_u64(out, cache.max_token_size);
+	write_u64(out, cache.beam_width);
+	write_u64(out, cache.original_size);
+	write_u64(out, cache.compressed_size);
+
+	write_tokens(out, cache.tokens);
+
+	write_u64(out, cache.encoded.size());
+	for (const auto& [hash, text] : cache.encoded) {
+		write_u64(out, hash);
+		write_string(out, text);
+	}
+
+	write_names(out, cache.uniform_names);
+	write_names(out, cache.in_out_names);
+
+	writeFile(path, out);
+}
+
+// Function to load a shared dictionary, which unlike a cache must be usable
+SharedDictionary load_shared_dictionary(const std::string& path) {
+	MappedFile file(path);
+
+	SharedDictionary dictionary;
+	try {
+		CacheReader reader{file.view()};
+		if (reader.u64() != (((uint64_t)SHARED_DICTIONARY_FORMAT << 32) | SHARED_DICTIONARY_MAGIC)) throw std::runtime_error("format");
+		read_tokens(reader, dictionary.tokens);
+		read_names(reader, dictionary.uniformNames);
+		read_names(reader, dictionary.inOutNames);
+		if (reader.pos != reader.data.size()) throw std::runtime_error("size");
+	} catch (const std::exception&) {
+		throw std::runtime_error("Error: Invalid shared dictionary " + path);
+	}
+
+	return dictionary;
+}
+
+// Function to save a shared dictionary
+void save_shared_dictionary(const std::string& path, const SharedDictionary& dictionary) {
+	std::string out;
+	write_u64(out, ((uint64_t)SHARED_DICTIONARY_FORMAT << 32) | SHARED_DICTIONARY_MAGIC);
+	write_tokens(out, dictionary.tokens);
+	write_names(out, dictionary.uniformNames);
+	write_names(out, dictionary.inOutNames);
+	writeFile(path, out);
+}
+
+// Function to compress texts with a cached dictionary while it still compresses them well enough,
+// otherwise searching the tokens again and caching the new dictionary. Only texts missing from the cache are encoded.
+Tokens compress_with_cache(
+	std::unordered_map<std::string, std::string>& texts,
+	DictionaryCache& cache,
+	double thresholdPercent,
+	size_t minTokenSize,
+	size_t maxTokenSize,
+	ThreadPool& pool,
+	const CompressionBudget& budget,
+	size_t beamWidth,
+	bool verbose,
+	bool& updated,
+	DictionaryCacheStats& stats
+) {
+	std::unordered_map<std::string, uint64_t> hashes;
+	uint64_t original_size = 0;
+	for (const auto& [name, text] : texts) {
+		hashes[name] = text_hash(text);
+		original_size += text.size();
+	}
+
+	updated = false;
+	stats = DictionaryCacheStats();
+	stats.texts = texts.size();
+	// A dictionary found with another search is not reused, so that the search asked for is always run
+	if (cache.original_size > 0 && cache.min_token_size == minTokenSize && cache.max_token_size == maxTokenSize && cache.beam_width == beamWidth) {
+		std::unordered_map<std::string, std::string> encoded = texts;
+		size_t reencoded = 0;
+		for (auto& [name, text] : encoded) {
+			auto it = cache.encoded.find(hashes[name]);
+			if (it != cache.encoded.end()) {
+				text = it->second;
+			}
+			else {
+				encode_text(text, cache.tokens);
+				reencoded++;
+			}
+		}
+
+		stats.reused = true;
+		stats.encoded = reencoded;
+		stats.cached_ratio = (double)cache.compressed_size / cache.original_size;
+		stats.ratio = (double)compressed_size(encoded, cache.tokens) / std::max<uint64_t>(original_size, 1);
+
+		if (stats.ratio <= stats.cached_ratio * (1.0 + thresholdPercent / 100.0)) {
+			// Only the texts in use are kept
+			std::unordered_map<uint64_t, std::string> entries;
+			for (const auto& [name, text] : encoded) entries[hashes[name]] = text;
+			if (reencoded > 0 || entries.size() != cache.encoded.size()) {
+				cache.encoded = std::move(entries);
+				updated = true;
+			}
+
+			// No token was searched for this job
+			texts = std::move(encoded);
+			Tokens tokens = cache.tokens;
+			tokens.stats.iterations.clear();
+			return tokens;
+		}
+	}
+
+	stats.searched = true;
+	Tokens tokens = compress_texts(texts, minTokenSize, maxTokenSize, pool, budget, beamWidth, verbose);
+
+	cache = DictionaryCache();
+	cache.min_token_size = minTokenSize;
+	cache.max_token_size = maxTokenSize;
+	cache.beam_width = beamWidth;
+	cache.original_size = original_size;
+	cache.compressed_size = compressed_size(texts, tokens);
+	cache.tokens = tokens;
+	for (const auto& [name, text] : texts) cache.encoded[hashes[name]] = text;
+	updated = true;
+
+	return tokens;
+}
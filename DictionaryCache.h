@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "Token.h"
+
+// Dictionary found by the last full search, with the encoding of every text it was used for
+struct DictionaryCache {
+	uint64_t min_token_size = 0;
+	uint64_t max_token_size = 0;
+	uint64_t beam_width = 1;      // Search the dictionary was found with, 1 for greedy
+	uint64_t original_size = 0;   // Size of the texts at the last full search, 0 if there was none
+	uint64_t compressed_size = 0; // Size they compressed to, dictionary included
+	Tokens tokens;
+	std::unordered_map<uint64_t, std::string> encoded; // Encoded texts by hash of the text
+	// Global names of the externals of the texts, which the tokens contain
+	std::unordered_map<std::string, std::string> uniform_names;
+	std::unordered_map<std::string, std::string> in_out_names;
+};
+
+bool load_dictionary_cache(const std::string& path, DictionaryCache& cache);
+
+void save_dictionary_cache(const std::string& path, const DictionaryCache& cache);
+
+// Dictionary learned once from a sample of shaders to encode other packs without searching. The global names of
+// the externals of the sample are kept too, so that the same externals get the same names, which the tokens contain.
+struct SharedDictionary {
+	Tokens tokens;
+	std::unordered_map<std::string, std::string> uniformNames;
+	std::unordered_map<std::string, std::string> inOutNames;
+};
+
+// What compress_with_cache did with the cached dictionary, for the caller to report
+struct DictionaryCacheStats {
+	bool reused = false;      // Whether a dictionary found with the same settings was cached and tried
+	size_t encoded = 0;       // Texts missing from the cache, encoded with its dictionary
+	size_t texts = 0;
+	double ratio = 0;         // Compression ratio of the texts with the cached dictionary
+	double cached_ratio = 0;  // Compression ratio when the dictionary was found
+	bool searched = false;    // Whether the tokens were searched again
+};
+
+SharedDictionary load_shared_dictionary(const std::string& path);
+
+void save_shared_dictionary(const std::string& path, const SharedDictionary& dictionary);
+
+Tokens compress_with_cache(
+	std::unordered_map<std::string, std::string>& texts,
+	DictionaryCache& cache,
+	double thresholdPercent,
+	size_t minTokenSize,
+	size_t maxTokenSize,
+	ThreadPool& pool,
+	const CompressionBudget& budget,
+	size_t beamWidth,
+	bool verbose,
+	bool& updated,
+	DictionaryCacheStats& stats
+);
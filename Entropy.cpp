@@ -0,0 +1,214 @@
+#include "Entropy.h"
+#include "PackFormat.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+// Computes the Huffman code length of every symbol, without any length limit
+static std::array<uint8_t, 256> huffman_lengths(const std::array<size_t, 256>& weights) {
+	std::array<uint8_t, 256> lengths{};
+
+	std::vector<size_t> nodeWeights;
+	std::vector<int> parents;
+	std::priority_queue<std::pair<size_t, int>, std::vector<std::pair<size_t, int>>, std::greater<>> queue;
+	for (int symbol = 0; symbol < 256; symbol++) {
+		if (weights[symbol] == 0) continue;
+		queue.push({weights[symbol], symbol});
+	}
+
+	if (queue.size() == 1) {
+		lengths[queue.top().second] = 1;
+		return lengths;
+	}
+
+	// Leaves are the 256 symbols, internal nodes follow them
+	nodeWeights.assign(weights.begin(), weights.end());
+	parents.assign(256, -1);
+	while (queue.size() > 1) {
+		auto [weightA, a] = queue.top();
+		queue.pop();
+		auto [weightB, b] = queue.top();
+		queue.pop();
+
+		int node = (int)nodeWeights.size();
+		nodeWeights.push_back(weightA + weightB);
+		parents.push_back(-1);
+		parents[a] = parents[b] = node;
+		queue.push({weightA + weightB, node});
+	}
+
+	for (int symbol = 0; symbol < 256; symbol++) {
+		if (weights[symbol] == 0) continue;
+		int length = 0;
+		for (int node = symbol; parents[node] != -1; node = parents[node]) length++;
+		lengths[symbol] = (uint8_t)std::min(length, 255);
+	}
+
+	return lengths;
+}
+
+static uint32_t reverse_bits(uint32_t code, int length) {
+	uint32_t reversed = 0;
+	for (int i = 0; i < length; i++) {
+		reversed = (reversed << 1) | ((code >> i) & 1);
+	}
+	return reversed;
+}
+
+// Function to build a canonical Huffman code of at most HUFFMAN_MAX_LENGTH bits from byte frequencies
+HuffmanCode build_huffman_code(const std::array<size_t, 256>& frequencies) {
+	HuffmanCode code;
+	std::array<size_t, 256> weights = frequencies;
+
+	// Flattening the weights until the longest code fits keeps the code close to optimal
+	while (true) {
+		code.lengths = huffman_lengths(weights);
+		if (*std::max_element(code.lengths.begin(), code.lengths.end()) <= HUFFMAN_MAX_LENGTH) break;
+		for (size_t& weight : weights) {
+			if (weight > 0) weight = (weight + 1) / 2;
+		}
+	}
+
+	std::array<uint32_t, HUFFMAN_MAX_LENGTH + 1> lengthCount{};
+	for (uint8_t length : code.lengths) {
+		if (length > 0) lengthCount[length]++;
+	}
+
+	std::array<uint32_t, HUFFMAN_MAX_LENGTH + 1> nextCode{};
+	uint32_t next = 0;
+	for (int length = 1; length <= HUFFMAN_MAX_LENGTH; length++) {
+		next = (next + lengthCount[length - 1]) << 1;
+		nextCode[length] = next;
+	}
+
+	for (int symbol = 0; symbol < 256; symbol++) {
+		int length = code.lengths[symbol];
+		if (length == 0) continue;
+		code.codes[symbol] = reverse_bits(nextCode[length]++, length);
+	}
+
+	return code;
+}
+
+// Function to identify a code, so that a decoder can check a pack was coded with its own code
+uint32_t huffman_code_hash(const HuffmanCode& code) {
+	uint32_t hash = fnv1a(code.lengths.data(), code.lengths.size());
+	return hash == 0 ? 1 : hash;
+}
+
+// Function to append the Huffman coding of a text, padded to a whole byte
+void huffman_encode(std::string_view text, const HuffmanCode& code, std::vector<uint8_t>& out) {
+	uint64_t bits = 0;
+	int bitCount = 0;
+
+	for (char c : text) {
+		uint8_t symbol = static_cast<uint8_t>(c);
+		if (code.lengths[symbol] == 0) {
+			throw std::runtime_error("Error: Byte missing from the Huffman code.");
+		}
+
+		bits |= (uint64_t)code.codes[symbol] << bitCount;
+		bitCount += code.lengths[symbol];
+		while (bitCount >= 8) {
+			out.push_back(static_cast<uint8_t>(bits));
+			bits >>= 8;
+			bitCount -= 8;
+		}
+	}
+
+	if (bitCount > 0) out.push_back(static_cast<uint8_t>(bits));
+}
+
+// Function to build the lookup tables of a Huffman decoder
+HuffmanDecoder make_huffman_decoder(const HuffmanCode& code) {
+	HuffmanDecoder decoder;
+
+	for (int symbol = 0; symbol < 256; symbol++) {
+		if (code.lengths[symbol] > 0) decoder.count[code.lengths[symbol]]++;
+	}
+
+	uint32_t next = 0, index = 0;
+	for (int length = 1; length <= HUFFMAN_MAX_LENGTH; length++) {
+		next = (next + decoder.count[length - 1]) << 1;
+		decoder.first[length] = next;
+		decoder.index[length] = index;
+		index += decoder.count[length];
+	}
+
+	for (int length = 1; length <= HUFFMAN_MAX_LENGTH; length++) {
+		for (int symbol = 0; symbol < 256; symbol++) {
+			if (code.lengths[symbol] == length) decoder.symbols.push_back((uint8_t)symbol);
+		}
+	}
+
+	// Single symbol lookup, every index whose low bits hold a code decodes to its symbol
+	const uint32_t size = 1u << HUFFMAN_TABLE_BITS;
+	std::vector<std::pair<uint8_t, int>> single(size, {0, 0});
+	for (int symbol = 0; symbol < 256; symbol++) {
+		int length = code.lengths[symbol];
+		if (length == 0 || length > HUFFMAN_TABLE_BITS) continue;
+		for (uint32_t fill = 0; fill < (size >> length); fill++) {
+			single[code.codes[symbol] | (fill << length)] = {(uint8_t)symbol, length};
+		}
+	}
+
+	// Then chain as many symbols as fit in the looked up bits
+	decoder.lookup.resize(size);
+	for (uint32_t i = 0; i < size; i++) {
+		uint32_t used = 0, symbols = 0, entry = 0;
+		while (symbols < 3) {
+			auto [symbol, length] = single[i >> used];
+			if (length == 0 || used + length > HUFFMAN_TABLE_BITS) break;
+			entry |= (uint32_t)symbol << (8 + 8 * symbols);
+			used += length;
+			symbols++;
+		}
+		decoder.lookup[i] = entry | used | (symbols << 4);
+	}
+
+	return decoder;
+}
+
+// Function to decode a given number of bytes, mirroring the generated decoder
+void huffman_decode(const uint8_t* read, uint8_t* dest, size_t count, const HuffmanDecoder& decoder) {
+	const uint8_t* end = dest + count;
+	const uint32_t mask = (1u << HUFFMAN_TABLE_BITS) - 1;
+	uint32_t bits = 0;
+	int bitCount = 0;
+
+	while (dest < end) {
+		while (bitCount <= 24) {
+			bits |= (uint32_t)*read++ << bitCount;
+			bitCount += 8;
+		}
+
+		uint32_t entry = decoder.lookup[bits & mask];
+		uint32_t symbols = (entry >> 4) & 3;
+		if (symbols) {
+			for (uint32_t k = 0; k < symbols && dest < end; k++) {
+				*dest++ = static_cast<uint8_t>(entry >> (8 + 8 * k));
+			}
+			bits >>= entry & 15;
+			bitCount -= entry & 15;
+			continue;
+		}
+
+		uint32_t code = 0;
+		for (int length = 1;; length++) {
+			code |= bits & 1;
+			bits >>= 1;
+			bitCount--;
+			if (code - decoder.first[length] < decoder.count[length]) {
+				*dest++ = decoder.symbols[decoder.index[length] + code - decoder.first[length]];
+				break;
+			}
+			if (length == HUFFMAN_MAX_LENGTH) {
+				throw std::runtime_error("Error: Invalid Huffman coded data.");
+			}
+			code <<= 1;
+		}
+	}
+}
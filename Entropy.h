@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Longest Huffman code, and number of bits looked up at once by the decoders
+constexpr int HUFFMAN_MAX_LENGTH = 15;
+constexpr int HUFFMAN_TABLE_BITS = 10;
+
+// Canonical Huffman code over bytes, codes are stored bit-reversed so that they are read least significant bit first
+struct HuffmanCode {
+	std::array<uint8_t, 256> lengths{}; // 0 for bytes that never occur
+	std::array<uint32_t, 256> codes{};
+};
+
+// Tables of a Huffman decoder. Each lookup entry decodes up to 3 symbols fitting in HUFFMAN_TABLE_BITS bits:
+// bits used in bits 0-3, symbol count in bits 4-5, then the symbols from bit 8. Codes too long for it are
+// decoded one bit at a time from the canonical tables, first[length] being the first code of each length.
+struct HuffmanDecoder {
+	std::vector<uint32_t> lookup;
+	std::array<uint32_t, HUFFMAN_MAX_LENGTH + 1> first{};
+	std::array<uint32_t, HUFFMAN_MAX_LENGTH + 1> count{};
+	std::array<uint32_t, HUFFMAN_MAX_LENGTH + 1> index{};
+	std::vector<uint8_t> symbols; // Symbols sorted by code
+};
+
+HuffmanCode build_huffman_code(const std::array<size_t, 256>& frequencies);
+
+uint32_t huffman_code_hash(const HuffmanCode& code);
+
+void huffman_encode(std::string_view text, const HuffmanCode& code, std::vector<uint8_t>& out);
+
+HuffmanDecoder make_huffman_decoder(const HuffmanCode& code);
+
+void huffman_decode(const uint8_t* read, uint8_t* dest, size_t count, const HuffmanDecoder& decoder);
@@ -1,45 +1,219 @@
 #include "FileUtils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
-#include <sstream>
 #include <filesystem>
+#include <iterator>
+#include <stdexcept>
 #include <string>
 
-// Function to read content from a file to a string
-std::string readFile(const std::string& filePath) {
-	std::ifstream file(filePath);
-	if (!file.is_open()) {
+#if defined(__unix__) || defined(__APPLE__)
+#define FILEUTILS_POSIX
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& filePath, bool map) {
+#ifdef FILEUTILS_POSIX
+	int fd = open(filePath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("Failed to open file: " + filePath);
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
 		throw std::runtime_error("Failed to open file: " + filePath);
 	}
 
-	std::stringstream buffer;
-	buffer << file.rdbuf();
-	std::string content = buffer.str();
+	// Empty files cannot be mapped, and pipes or devices have no size to map
+	if (map && S_ISREG(info.st_mode) && info.st_size > 0) {
+		void* memory = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (memory != MAP_FAILED) {
+			close(fd);
+			data = static_cast<const char*>(memory);
+			size = (size_t)info.st_size;
+			mapped = true;
+			return;
+		}
+	}
 
-	for (size_t i = 0; i < content.size(); ++i) {
-		unsigned char c = static_cast<unsigned char>(content[i]);
-		if (c > 127) {
-			throw std::runtime_error("Non-ASCII character detected at byte " + std::to_string(i) + " in file " + filePath);
+	// Read until the end, as the file may have changed size since fstat
+	buffer.resize(S_ISREG(info.st_mode) ? (size_t)info.st_size + 1 : 4096);
+	size_t length = 0;
+	while (true) {
+		if (length == buffer.size()) buffer.resize(buffer.size() * 2);
+		ssize_t count = read(fd, &buffer[length], buffer.size() - length);
+		if (count < 0 && errno == EINTR) continue;
+		if (count < 0) {
+			close(fd);
+			throw std::runtime_error("Failed to read file: " + filePath);
 		}
+		if (count == 0) break;
+		length += (size_t)count;
 	}
+	close(fd);
 
-	return content;
+	buffer.resize(length);
+	data = buffer.data();
+	size = buffer.size();
+#else
+	std::ifstream file(filePath, std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open file: " + filePath);
+	}
+	buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	data = buffer.data();
+	size = buffer.size();
+#endif
 }
 
-// Function to write a string to a file
-void writeFile(const std::string& filePath, const std::string& content) {
-	std::ofstream file(filePath);
-	if (!file) {
-		throw std::runtime_error("Failed to open file for writing: " + filePath);
+MappedFile::~MappedFile() {
+	release();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+	if (this == &other) return *this;
+	release();
+
+	mapped = other.mapped;
+	buffer = std::move(other.buffer);
+	data = mapped ? other.data : buffer.data();
+	size = other.size;
+
+	other.data = nullptr;
+	other.size = 0;
+	other.mapped = false;
+	return *this;
+}
+
+void MappedFile::release() {
+#ifdef FILEUTILS_POSIX
+	if (mapped) munmap(const_cast<char*>(data), size);
+#endif
+	data = nullptr;
+	size = 0;
+	mapped = false;
+	buffer.clear();
+}
+
+// Function to find the first non-ASCII byte of a text, testing the high bit of 32 bytes at a time
+size_t findNonASCII(std::string_view text) {
+	constexpr uint64_t HIGH_BITS = 0x8080808080808080ull;
+	const char* bytes = text.data();
+	const size_t n = text.size();
+
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		uint64_t words[4];
+		std::memcpy(words, bytes + i, sizeof(words));
+		if ((words[0] | words[1] | words[2] | words[3]) & HIGH_BITS) break;
+	}
+
+	for (; i < n; i++) {
+		if (static_cast<unsigned char>(bytes[i]) > 127) return i;
 	}
-	file << content;
+	return std::string_view::npos;
+}
+
+// Function to write a string to a file
+void writeFile(const std::string& filePath, std::string_view content) {
+	writeFile(filePath, std::vector<std::string_view>{content});
 }
 
 // Function to write binary content to a file
 void writeFile(const std::string& filePath, const std::vector<uint8_t>& content) {
-	std::ofstream file(filePath, std::ios::binary);
-	if (!file) {
-		throw std::runtime_error("Failed to open file for writing: " + filePath);
+	writeFile(filePath, std::string_view(reinterpret_cast<const char*>(content.data()), content.size()));
+}
+
+// Function to name a temporary file next to the given one, unique to this process and call so that concurrent
+// writers of the same file never share it
+static std::string temporaryPathFor(const std::string& filePath) {
+	static std::atomic<uint64_t> counter{0};
+#ifdef FILEUTILS_POSIX
+	uint64_t owner = (uint64_t)getpid();
+#else
+	uint64_t owner = (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+	return filePath + ".tmp." + std::to_string(owner) + "." + std::to_string(counter++);
+}
+
+// Function to write buffers one after the other to a file, with a single writev call when the system takes them all at once.
+// They are written to a temporary file renamed over the file, so that readers see either the old content or the new one.
+void writeFile(const std::string& filePath, const std::vector<std::string_view>& buffers) {
+	std::string temporaryPath = temporaryPathFor(filePath);
+
+#ifdef FILEUTILS_POSIX
+	int fd;
+	while ((fd = open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666)) < 0 && errno == EEXIST) {
+		temporaryPath = temporaryPathFor(filePath);
+	}
+	if (fd < 0) {
+		throw std::runtime_error("Failed to open file for writing: " + temporaryPath);
+	}
+
+	std::vector<iovec> vectors;
+	for (std::string_view buffer : buffers) {
+		if (!buffer.empty()) vectors.push_back({const_cast<char*>(buffer.data()), buffer.size()});
+	}
+
+	// Partial writes resume from the first byte not written yet
+	size_t next = 0;
+	while (next < vectors.size()) {
+		int count = (int)std::min<size_t>(vectors.size() - next, IOV_MAX);
+		ssize_t written = writev(fd, &vectors[next], count);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			close(fd);
+			std::remove(temporaryPath.c_str());
+			throw std::runtime_error("Failed to write file: " + temporaryPath);
+		}
+
+		for (size_t remaining = (size_t)written; remaining > 0;) {
+			size_t consumed = std::min(remaining, vectors[next].iov_len);
+			vectors[next].iov_base = static_cast<char*>(vectors[next].iov_base) + consumed;
+			vectors[next].iov_len -= consumed;
+			remaining -= consumed;
+			if (vectors[next].iov_len == 0) next++;
+		}
+	}
+
+	if (close(fd) != 0) {
+		std::remove(temporaryPath.c_str());
+		throw std::runtime_error("Failed to write file: " + temporaryPath);
+	}
+#else
+	{
+		std::ofstream file(temporaryPath, std::ios::binary);
+		if (!file) {
+			throw std::runtime_error("Failed to open file for writing: " + temporaryPath);
+		}
+		for (std::string_view buffer : buffers) file.write(buffer.data(), buffer.size());
+		if (!file) {
+			file.close();
+			std::remove(temporaryPath.c_str());
+			throw std::runtime_error("Failed to write file: " + temporaryPath);
+		}
+	}
+#endif
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, filePath, error);
+	if (error) {
+		std::remove(temporaryPath.c_str());
+		throw std::runtime_error("Failed to replace file: " + filePath);
 	}
-	file.write(reinterpret_cast<const char*>(content.data()), content.size());
 }
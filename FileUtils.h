@@ -2,8 +2,37 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
-std::string readFile(const std::string& filePath);
-void writeFile(const std::string& filePath, const std::string& content);
+// A read-only view over the content of a file, mapped in memory where the platform allows it and read otherwise.
+// A mapped file that is truncated while its view is read raises SIGBUS: files that may be rewritten meanwhile,
+// like the ones of a watched directory, should be read instead.
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& filePath, bool map = true);
+	~MappedFile();
+
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	std::string_view view() const { return {data, size}; }
+
+private:
+	void release();
+
+	const char* data = nullptr;
+	size_t size = 0;
+	bool mapped = false;
+	std::string buffer;
+};
+
+// Returns the position of the first byte above 127, or std::string_view::npos if the text is ASCII
+size_t findNonASCII(std::string_view text);
+
+// Files are written to a temporary file renamed over the previous one, readers seeing either the previous content or the new one
+void writeFile(const std::string& filePath, std::string_view content);
 void writeFile(const std::string& filePath, const std::vector<uint8_t>& content);
+void writeFile(const std::string& filePath, const std::vector<std::string_view>& buffers);
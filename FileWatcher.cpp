@@ -0,0 +1,93 @@
+#include "FileWatcher.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Changes closer together than this are reported at once, editors often write a file in several steps
+static constexpr int SETTLE_MS = 15;
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher(const std::vector<std::string>& watchedFiles) : files(watchedFiles) {
+	fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0) {
+		throw std::runtime_error("Error: Failed to initialize inotify.");
+	}
+
+	for (const std::string& file : files) {
+		paths.push_back(std::filesystem::absolute(file).lexically_normal().string());
+
+		std::string directory = std::filesystem::path(paths.back()).parent_path().string();
+		auto known = std::find_if(directories.begin(), directories.end(), [&](const auto& watch) { return watch.second == directory; });
+		if (known != directories.end()) continue;
+
+		int wd = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+		if (wd < 0) {
+			close(fd);
+			throw std::runtime_error("Error: Failed to watch directory " + directory + ".");
+		}
+		directories.push_back({wd, directory});
+	}
+}
+
+FileWatcher::~FileWatcher() {
+	if (fd >= 0) close(fd);
+}
+
+// Function to wait for changes of the watched files
+std::vector<std::string> FileWatcher::wait() {
+	std::vector<std::string> changed;
+	alignas(inotify_event) char buffer[16 * 1024];
+
+	while (true) {
+		// Block for the first change, then keep reading until none came for a moment
+		pollfd pfd{fd, POLLIN, 0};
+		int ready = poll(&pfd, 1, changed.empty() ? -1 : SETTLE_MS);
+		if (ready < 0) {
+			throw std::runtime_error("Error: Failed to wait for file changes.");
+		}
+		if (ready == 0) return changed;
+
+		ssize_t length = read(fd, buffer, sizeof(buffer));
+		if (length <= 0) {
+			throw std::runtime_error("Error: Failed to read file changes.");
+		}
+
+		for (ssize_t offset = 0; offset < length;) {
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+			offset += sizeof(inotify_event) + event->len;
+			if (event->len == 0) continue;
+
+			auto directory = std::find_if(directories.begin(), directories.end(), [&](const auto& watch) { return watch.first == event->wd; });
+			if (directory == directories.end()) continue;
+
+			std::string path = (std::filesystem::path(directory->second) / event->name).string();
+			for (size_t i = 0; i < files.size(); i++) {
+				if (paths[i] == path && std::find(changed.begin(), changed.end(), files[i]) == changed.end()) {
+					changed.push_back(files[i]);
+				}
+			}
+		}
+	}
+}
+
+#else
+
+FileWatcher::FileWatcher(const std::vector<std::string>&) {
+	throw std::runtime_error("Error: --watch is only supported on Linux.");
+}
+
+FileWatcher::~FileWatcher() {}
+
+std::vector<std::string> FileWatcher::wait() {
+	return {};
+}
+
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Watches a set of files for changes, including files replaced by a rename as many editors save them.
+// Only supported on Linux, where it uses inotify on the directories of the files.
+class FileWatcher {
+public:
+	explicit FileWatcher(const std::vector<std::string>& files);
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	// Blocks until some files changed, then returns them as they were given, once they stayed unchanged for a moment
+	std::vector<std::string> wait();
+
+private:
+	std::vector<std::string> files;
+	std::vector<std::string> paths; // Absolute path of each file
+	std::vector<std::pair<int, std::string>> directories; // Watch descriptor and directory of each watch
+	int fd = -1;
+};
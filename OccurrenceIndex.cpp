@@ -0,0 +1,437 @@
+#include "OccurrenceIndex.h"
+#include "SuffixArray.h"
+
+#include <algorithm>
+
+// Candidates containing a replacement are discovered in a window of this many bytes around it
+// when there is no maximum token size, longer ones are found by the next full rebuild
+static constexpr size_t DISCOVERY_WINDOW = 64;
+
+// Bytes used to build the suffix array of each byte of text, and chunks the texts are sampled by when that does not fit
+// in the memory budget. Half of the budget goes to the suffix array, the other half to the candidates,
+// which are briefly held twice while merged.
+static constexpr size_t INDEX_BYTES_PER_BYTE = 24;
+static constexpr size_t SAMPLE_CHUNK = 4096;
+
+// Within a memory budget, the suffix array is always split in as many parts, each one keeping its share of the best
+// candidates, so that which ones are dropped does not depend on the thread count
+static constexpr size_t BUDGET_PARTS = 64;
+
+// The index is rebuilt from scratch once the texts shrank by more than 1/REBUILD_SHRINK_DIVISOR since the last build
+static constexpr size_t REBUILD_SHRINK_DIVISOR = 10;
+
+// With a lookahead, each branch picks its next tokens greedily among this many candidates per branch
+static constexpr size_t LOOKAHEAD_CANDIDATES_PER_BRANCH = 4;
+
+OccurrenceIndex::OccurrenceIndex(std::unordered_map<std::string, std::string>& textMap, size_t minTokenSize, size_t maxTokenSize, const CompressionBudget& budget, ThreadPool& pool)
+	: pool(pool), minTokenSize(minTokenSize), maxTokenSize(maxTokenSize), memory_budget(budget.memory_bytes) {
+	for (auto& [name, text] : textMap) texts.push_back(&text);
+
+	timed = budget.time_ms > 0;
+	deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(budget.time_ms);
+	max_candidates = memory_budget > 0 ? std::max<size_t>(memory_budget / 4 / sizeof(Candidate), 1) : 0;
+}
+
+
+// Orders candidates by score, then length, then content, with up to date counts first
+bool OccurrenceIndex::worse(const Candidate& a, const Candidate& b) {
+	if (a.score != b.score) return a.score < b.score;
+	if (a.token.size() != b.token.size()) return a.token.size() < b.token.size();
+	int cmp = a.token.compare(b.token);
+	if (cmp != 0) return cmp > 0;
+	return a.generation < b.generation;
+}
+
+int OccurrenceIndex::score(size_t length, int count) const {
+	int long_rep = find_large ? 3 : 1;
+	return (int)length * (count - 1) - count * long_rep - TOKEN_STORAGE_COST;
+}
+
+// Counts the occurrences of a token, overlapping ones included, that do not start inside a '$' escape
+int OccurrenceIndex::count_occurrences(std::string_view token) const {
+	std::vector<int> counts(texts.size(), 0);
+
+	pool.run(texts.size(), [&](size_t i) {
+		counts[i] = count_token(*texts[i], token);
+	});
+
+	int count = 0;
+	for (int c : counts) count += c;
+	return count;
+}
+
+// Whether occurrences of two strings can overlap, in which case replacing one may remove occurrences of the other
+static bool may_overlap(std::string_view a, std::string_view b) {
+	if (a.find(b) != std::string_view::npos || b.find(a) != std::string_view::npos) return true;
+
+	size_t shortest = std::min(a.size(), b.size());
+	for (size_t k = 1; k < shortest; k++) {
+		if (a.substr(a.size() - k) == b.substr(0, k)) return true;
+		if (b.substr(b.size() - k) == a.substr(0, k)) return true;
+	}
+	return false;
+}
+
+void OccurrenceIndex::push(const Candidate& candidate) {
+	heap.push_back(candidate);
+	std::push_heap(heap.begin(), heap.end(), worse);
+}
+
+// Function to drop all but the given number of best candidates, returning how many were dropped
+size_t OccurrenceIndex::keep_best(std::vector<Candidate>& candidates, size_t count) {
+	if (candidates.size() <= count) return 0;
+
+	std::nth_element(candidates.begin(), candidates.begin() + count, candidates.end(), [](const Candidate& a, const Candidate& b) {
+		return worse(b, a);
+	});
+	size_t removed = candidates.size() - count;
+	candidates.resize(count);
+	return removed;
+}
+
+// Function to collect the repeats of a snapshot as candidates, optionally only those containing a replacement
+// When the snapshot only holds the given fraction of the texts, counts are scaled up and marked for a recount.
+// Candidates that can never score are not kept.
+std::vector<OccurrenceIndex::Candidate> OccurrenceIndex::collect_repeats(const std::string& snapshot, const std::vector<std::string_view>& views, const std::string* replacement, double fraction) {
+	size_t maxLength = maxTokenSize;
+	if (replacement && maxLength == 0) maxLength = DISCOVERY_WINDOW;
+
+	// Positions in the suffix array match positions in the snapshot, separators included
+	SuffixArray index = build_suffix_array(views, pool);
+
+	// Ranges are collected into their own shard and merged in order, so the result does not depend on the thread count
+	std::vector<std::pair<size_t, size_t>> ranges = repeat_ranges(index, minTokenSize, max_candidates > 0 ? BUDGET_PARTS : pool.size() * 4);
+	std::vector<std::vector<Candidate>> shards(ranges.size());
+	std::vector<size_t> shard_dropped(ranges.size(), 0);
+	size_t shard_candidates = std::max<size_t>(max_candidates / ranges.size(), 1);
+	size_t shard_limit = shard_candidates + shard_candidates / 4 + 1;
+
+	pool.run(ranges.size(), [&](size_t i) {
+		if (max_candidates > 0) shards[i].reserve(shard_limit);
+
+		for_each_repeat(index, minTokenSize, maxLength, ranges[i], [&](const Repeat& repeat) {
+			std::string_view token = std::string_view(snapshot).substr(repeat.position, repeat.length);
+			size_t min_length = repeat.min_length;
+
+			if (replacement) {
+				size_t found = token.find(*replacement);
+				if (found == std::string_view::npos) return;
+
+				min_length = std::max(min_length, found + replacement->size());
+				while (min_length <= token.size() && !may_end(index, repeat.position + min_length)) min_length++;
+				if (min_length > token.size()) return;
+			}
+
+			int count = fraction < 1.0 ? (int)(repeat.count / fraction + 0.5) : (int)repeat.count;
+			int token_score = score(token.size(), count);
+			if (token_score <= 0) return;
+
+			shards[i].push_back({token, min_length, count, count, token_score, generation, false, fraction < 1.0});
+
+			if (max_candidates > 0 && shards[i].size() == shard_limit) shard_dropped[i] += keep_best(shards[i], shard_candidates);
+		});
+
+		if (max_candidates > 0) {
+			shard_dropped[i] += keep_best(shards[i], shard_candidates);
+			shards[i].shrink_to_fit();
+		}
+	});
+
+	for (size_t count : shard_dropped) dropped += count;
+	if (shards.empty()) return {};
+
+	size_t total = 0;
+	for (const auto& shard : shards) total += shard.size();
+
+	std::vector<Candidate> candidates = std::move(shards[0]);
+	candidates.reserve(total);
+	for (size_t i = 1; i < shards.size(); i++) {
+		candidates.insert(candidates.end(), shards[i].begin(), shards[i].end());
+		shards[i] = std::vector<Candidate>();
+	}
+
+	return candidates;
+}
+
+// Function to rebuild the candidate heap from a suffix array over the current texts
+void OccurrenceIndex::build(bool findLarge) {
+	find_large = findLarge;
+	heap = std::vector<Candidate>();
+	snapshots.clear();
+
+	size_t total = 0;
+	for (const std::string* text : texts) total += text->size();
+
+	// Past the memory budget, only evenly spread chunks of the texts are indexed
+	double fraction = 1.0;
+	if (memory_budget > 0 && total * INDEX_BYTES_PER_BYTE > memory_budget / 2) {
+		fraction = (double)(memory_budget / 2) / (total * INDEX_BYTES_PER_BYTE);
+		min_indexed_fraction = std::min(min_indexed_fraction, fraction);
+	}
+
+	std::string& snapshot = snapshots.emplace_back();
+	std::vector<std::pair<size_t, size_t>> spans;
+	size_t chunk = 0;
+	for (const std::string* text : texts) {
+		if (fraction == 1.0) {
+			spans.push_back({snapshot.size(), text->size()});
+			snapshot += *text;
+			snapshot += '\0';
+			continue;
+		}
+
+		for (size_t begin = 0; begin < text->size(); begin += SAMPLE_CHUNK, chunk++) {
+			if ((size_t)((chunk + 1) * fraction) == (size_t)(chunk * fraction)) continue;
+
+			// A chunk never starts inside a '$' escape
+			size_t start = begin;
+			while (start > 0 && ((*text)[start - 1] == '$' || (start > 1 && (*text)[start - 2] == '$'))) start--;
+			size_t end = std::min(text->size(), begin + SAMPLE_CHUNK);
+
+			spans.push_back({snapshot.size(), end - start});
+			snapshot.append(*text, start, end - start);
+			snapshot += '\0';
+		}
+	}
+
+	std::vector<std::string_view> views;
+	for (const auto& [begin, length] : spans) views.push_back(std::string_view(snapshot).substr(begin, length));
+
+	heap = collect_repeats(snapshot, views, nullptr, fraction);
+	std::make_heap(heap.begin(), heap.end(), worse);
+
+	built_generation = generation;
+	built_size = current_size = total;
+}
+
+// Function to get the best token, recounting stale candidates lazily
+TokenInfo OccurrenceIndex::best() {
+	return find_best(true);
+}
+
+// Function to get the best tokens, taking them off the heap while the next ones are found and pushing them back.
+// The index is not rebuilt past the first token, as that would drop the candidates taken off.
+std::vector<TokenInfo> OccurrenceIndex::top(size_t count) {
+	std::vector<TokenInfo> tokens;
+	std::vector<Candidate> taken;
+
+	while (tokens.size() < count) {
+		TokenInfo token = find_best(tokens.empty());
+		if (token.score <= 0 || token.token.empty()) break;
+
+		// The same token may be indexed more than once, from different snapshots
+		if (std::none_of(tokens.begin(), tokens.end(), [&](const TokenInfo& t) { return t.token == token.token; })) {
+			tokens.push_back(std::move(token));
+		}
+
+		std::pop_heap(heap.begin(), heap.end(), worse);
+		taken.push_back(heap.back());
+		heap.pop_back();
+	}
+
+	for (const Candidate& candidate : taken) push(candidate);
+	return tokens;
+}
+
+// Function to choose a token with a lookahead: each of the best tokens is replaced in its own copy of the texts,
+// followed by greedy choices among the best tokens for the next replacements, and the one saving the most bytes wins.
+// Branches are evaluated in parallel. Ties go to the best token, so that a width of 1 gives the greedy choice.
+TokenInfo OccurrenceIndex::best_lookahead(size_t width, const std::vector<std::string>& replacements) {
+	std::vector<TokenInfo> candidates = top(width * LOOKAHEAD_CANDIDATES_PER_BRANCH);
+	if (candidates.empty()) return {"", -1};
+
+	size_t branches = std::min(width, candidates.size());
+	if (branches == 1 || replacements.size() <= 1) return candidates[0];
+
+	std::vector<int> gains(branches, 0);
+	pool.run(branches, [&](size_t i) {
+		gains[i] = lookahead_gain(candidates, i, replacements);
+	});
+
+	size_t chosen = 0;
+	for (size_t i = 1; i < branches; i++) {
+		if (gains[i] > gains[chosen]) chosen = i;
+	}
+	return candidates[chosen];
+}
+
+// Function to measure the bytes saved by replacing a candidate then greedily the best of the others, on a copy of the texts.
+// Counts given by the index are kept unless a replacement of the branch may have changed them.
+int OccurrenceIndex::lookahead_gain(const std::vector<TokenInfo>& candidates, size_t first, const std::vector<std::string>& replacements) const {
+	std::vector<std::string> branch;
+	branch.reserve(texts.size());
+	for (const std::string* text : texts) branch.push_back(*text);
+
+	std::vector<int> counts(candidates.size());
+	for (size_t i = 0; i < candidates.size(); i++) counts[i] = candidates[i].count;
+	std::vector<bool> used(candidates.size(), false);
+
+	int gain = 0;
+	size_t next = first;
+	for (size_t step = 0; step < replacements.size(); step++) {
+		if (step > 0) {
+			next = candidates.size();
+			int best_score = 0;
+			for (size_t i = 0; i < candidates.size(); i++) {
+				int candidate_score = score(candidates[i].token.size(), counts[i]);
+				if (!used[i] && candidate_score > best_score) {
+					best_score = candidate_score;
+					next = i;
+				}
+			}
+			if (next == candidates.size()) break;
+		}
+		used[next] = true;
+
+		const std::string& token = candidates[next].token;
+		const std::string& replacement = replacements[step];
+		size_t removed = 0;
+		for (std::string& text : branch) {
+			size_t previous_size = text.size();
+			replace_token(text, token, replacement, nullptr);
+			removed += previous_size - text.size();
+		}
+		gain += (int)removed - (int)token.size() - TOKEN_STORAGE_COST;
+
+		if (step + 1 == replacements.size()) break;
+
+		bool shifts_escapes = replacement.find('$', 1) != std::string::npos;
+		for (size_t i = 0; i < candidates.size(); i++) {
+			if (used[i] || !(shifts_escapes || may_overlap(candidates[i].token, token))) continue;
+			counts[i] = 0;
+			for (const std::string& text : branch) counts[i] += count_token(text, candidates[i].token);
+		}
+	}
+
+	return gain;
+}
+
+// Function to get the exact score of the best candidate left, to tell what stopping now gives up
+int OccurrenceIndex::next_score() {
+	return std::max(find_best(false).score, 0);
+}
+
+// Within the budget, checks the time left and rebuilds the index once the candidates run out
+TokenInfo OccurrenceIndex::find_best(bool within_budget) {
+	while (true) {
+		if (within_budget && timed && std::chrono::steady_clock::now() >= deadline) {
+			stopped = true;
+			return {"", -1};
+		}
+
+		if (heap.empty() || heap.front().score <= 0) {
+			// Only give up once a full rebuild confirms there is nothing left
+			if (generation == built_generation || !within_budget) return {"", -1};
+			build(find_large);
+			continue;
+		}
+
+		if (heap.front().generation == generation && !heap.front().sampled) {
+			return {std::string(heap.front().token), heap.front().score, heap.front().count};
+		}
+
+		std::pop_heap(heap.begin(), heap.end(), worse);
+		Candidate candidate = heap.back();
+		heap.pop_back();
+
+		// The count is still exact if none of the tokens replaced since could overlap this one,
+		// unless a replacement put '$' bytes right before some occurrences, making them invalid starts
+		bool stale = candidate.sampled;
+		for (size_t g = candidate.generation; g < generation && !stale; g++) {
+			const auto& [token, replacement] = replaced[g];
+			stale = replacement.find('$', 1) != std::string::npos || may_overlap(candidate.token, token);
+		}
+		int count = stale ? count_occurrences(candidate.token) : candidate.count;
+
+		// Shorter prefixes may have kept occurrences this one lost, bound them by the indexed count
+		if (count < candidate.range_count && !candidate.split && candidate.token.size() > candidate.min_length) {
+			size_t length = candidate.token.size() - 1;
+			push({
+				candidate.token.substr(0, length), candidate.min_length, candidate.range_count,
+				candidate.range_count, score(length, candidate.range_count), candidate.generation, false, candidate.sampled
+			});
+			candidate.split = true;
+		}
+
+		if (count > 1) {
+			candidate.sampled = false;
+			candidate.count = count;
+			candidate.score = score(candidate.token.size(), count);
+			candidate.generation = generation;
+			push(candidate);
+		}
+	}
+}
+
+// Function to replace a token everywhere and index the new substrings spanning the replacements
+void OccurrenceIndex::replace(const std::string& token, const std::string& replacement) {
+	replaced.push_back({token, replacement});
+	generation++;
+
+	size_t radius = maxTokenSize > 0 ? maxTokenSize : DISCOVERY_WINDOW;
+
+	// Texts are rewritten independently, each one merging the windows around its replacements
+	std::vector<std::vector<std::pair<size_t, size_t>>> text_windows(texts.size());
+	std::vector<size_t> removed(texts.size(), 0);
+
+	pool.run(texts.size(), [&](size_t i) {
+		std::string& text = *texts[i];
+		std::vector<size_t> sites;
+		size_t previous_size = text.size();
+		replace_token(text, token, replacement, &sites);
+		removed[i] = previous_size - text.size();
+
+		// A window never starts inside a '$' escape
+		auto& windows = text_windows[i];
+		for (size_t site : sites) {
+			size_t begin = site >= radius ? site - radius + 1 : 0;
+			while (begin > 0 && (text[begin - 1] == '$' || (begin > 1 && text[begin - 2] == '$'))) begin--;
+			size_t end = std::min(text.size(), site + replacement.size() + radius - 1);
+
+			if (!windows.empty() && begin <= windows.back().second) {
+				windows.back().second = std::max(windows.back().second, end);
+			}
+			else {
+				windows.push_back({begin, end});
+			}
+		}
+	});
+
+	size_t windows_size = 0;
+	for (size_t i = 0; i < texts.size(); i++) {
+		current_size -= removed[i];
+		for (const auto& [begin, end] : text_windows[i]) windows_size += end - begin + 1;
+	}
+
+	// Indexing windows that cover most of the texts costs as much as a full rebuild
+	if ((built_size - current_size) * REBUILD_SHRINK_DIVISOR > built_size || windows_size * 2 > current_size) {
+		build(find_large);
+		return;
+	}
+
+	if (windows_size == 0) return;
+
+	std::string& snapshot = snapshots.emplace_back();
+	snapshot.reserve(windows_size);
+	std::vector<std::pair<size_t, size_t>> spans;
+	for (size_t i = 0; i < texts.size(); i++) {
+		for (const auto& [begin, end] : text_windows[i]) {
+			spans.push_back({snapshot.size(), end - begin});
+			snapshot.append(*texts[i], begin, end - begin);
+			snapshot += '\0';
+		}
+	}
+
+	std::vector<std::string_view> views;
+	for (const auto& [begin, length] : spans) views.push_back(std::string_view(snapshot).substr(begin, length));
+
+	// Every occurrence of a repeat containing the replacement lies within a window, so its count is exact
+	for (const Candidate& candidate : collect_repeats(snapshot, views, &replacement, 1.0)) {
+		push(candidate);
+	}
+
+	if (max_candidates > 0 && heap.size() > max_candidates) {
+		dropped += keep_best(heap, max_candidates);
+		std::make_heap(heap.begin(), heap.end(), worse);
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ThreadPool.h"
+#include "Token.h"
+
+// Candidate tokens of a set of texts, kept in a lazy max-heap and updated as tokens get replaced
+class OccurrenceIndex {
+public:
+	OccurrenceIndex(std::unordered_map<std::string, std::string>& texts, size_t minTokenSize, size_t maxTokenSize, const CompressionBudget& budget, ThreadPool& pool);
+
+	// Rebuilds the index from the current texts, scoring for single or multi-character tokens
+	void build(bool find_large);
+
+	// Returns the best token of the current texts, or a negative score if there is none or the time budget is over
+	TokenInfo best();
+
+	// Returns up to the given number of best tokens of the current texts, best first
+	std::vector<TokenInfo> top(size_t count);
+
+	// Returns, among the given number of best tokens, the one saving the most once followed by greedy choices
+	// for the next replacements given, or a negative score like best()
+	TokenInfo best_lookahead(size_t width, const std::vector<std::string>& replacements);
+
+	// Whether best() gave up because the time budget was over
+	bool interrupted() const { return stopped; }
+
+	// Returns the exact score of the best candidate left, without updating the others
+	int next_score();
+
+	double indexed_fraction() const { return min_indexed_fraction; }
+	size_t dropped_candidates() const { return dropped; }
+
+	// Replaces a token in every text and indexes the substrings created around the replacements
+	void replace(const std::string& token, const std::string& replacement);
+
+private:
+	struct Candidate {
+		std::string_view token; // Points into one of the snapshots
+		size_t min_length;      // Shortest prefix that had the same occurrences when indexed
+		int count;              // Occurrences at the given generation
+		int range_count;        // Occurrences shared by all prefixes when indexed, bounds their count
+		int score;
+		size_t generation;
+		bool split;             // Whether the shorter prefixes were pushed as their own candidate
+		bool sampled;           // Whether the count is estimated from part of the texts, and must be recounted
+	};
+
+	static bool worse(const Candidate& a, const Candidate& b);
+
+	int score(size_t length, int count) const;
+	int count_occurrences(std::string_view token) const;
+	void push(const Candidate& candidate);
+	static size_t keep_best(std::vector<Candidate>& candidates, size_t count);
+	TokenInfo find_best(bool within_budget);
+	int lookahead_gain(const std::vector<TokenInfo>& candidates, size_t first, const std::vector<std::string>& replacements) const;
+	std::vector<Candidate> collect_repeats(const std::string& snapshot, const std::vector<std::string_view>& views, const std::string* replacement, double fraction);
+
+	std::vector<std::string*> texts;
+	ThreadPool& pool;
+	size_t minTokenSize;
+	size_t maxTokenSize;
+	bool find_large = false;
+
+	std::deque<std::string> snapshots; // Text copies the candidates point into, dropped on rebuild
+	std::vector<Candidate> heap;
+	std::vector<std::pair<std::string, std::string>> replaced; // Token and replacement of each generation
+
+	size_t generation = 0;        // Number of replacements so far
+	size_t built_generation = 0;  // Generation of the last full build
+	size_t built_size = 0;        // Total text size at the last full build
+	size_t current_size = 0;
+
+	std::chrono::steady_clock::time_point deadline;
+	bool timed = false;
+	bool stopped = false;
+	size_t memory_budget;
+	size_t max_candidates;             // Candidates kept within the memory budget, 0 if unlimited
+	double min_indexed_fraction = 1.0;
+	size_t dropped = 0;
+};
@@ -1,74 +1,525 @@
 #include "OutputGenerator.h"
 #include "FileUtils.h"
+#include "PackFormat.h"
 
 #include <string_view>
 #include <sstream>
 #include <iomanip>
+#include <limits>
+#include <stdexcept>
+
+// The generated decompressor stack holds at least this many tokens, so that packs regenerated later can be swapped in
+static constexpr size_t MIN_TOKEN_DEPTH = 32;
 
 // Function to decompress shader source from packed content
-static constexpr std::string_view getShaderSourceFromFileSrc = R"(static size_t tknlen(const char* const token) {
-	size_t length = 0;
-	while (token[length]) {
-		if (token[length] == '$') {
-			length += 2;
-		}
-		length++;
+static constexpr std::string_view getShaderSourceFromFileSrc = R"(// Header fields of the pack, each one an unsigned 32-bit little-endian value
+enum PackField {
+	FIELD_MAGIC,
+	FIELD_FORMAT,
+	FIELD_SIZE,
+	FIELD_CHECKSUM,
+	FIELD_SHADER_COUNT,
+	FIELD_SHADER_TABLE,
+	FIELD_BUCKET_COUNT,
+	FIELD_BUCKET_TABLE,
+	FIELD_CHAR_TOKEN_COUNT,
+	FIELD_CHAR_TOKEN_TABLE,
+	FIELD_PACK_TOKEN_COUNT,
+	FIELD_PACK_TOKEN_TABLE,
+	FIELD_MAX_TOKEN_DEPTH,
+	FIELD_MAX_LENGTH,
+	FIELD_TOTAL_LENGTH,
+	FIELD_TOKEN_CACHE_SIZE,
+	FIELD_VERSION_OFFSET,
+	FIELD_VERSION_LENGTH,
+	FIELD_ENTROPY_CODE,
+	HEADER_FIELDS
+};
+
+#define HEADER_SIZE (HEADER_FIELDS * 4)
+#define SHADER_ENTRY_SIZE 16 // Name hash, name offset, offset and unpacked length
+#define TOKEN_ENTRY_SIZE 8   // Offset and expanded length
+#define ENTROPY_PREFIX_SIZE 8 // Coded byte count and unpacked length of entropy coded shaders
+
+static uint32_t readU32(const char* const data) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static uint32_t packField(const char* const pack, int field) {
+	return readU32(&pack[field * 4]);
+}
+
+static const char* shaderEntry(const char* const pack, size_t index) {
+	return &pack[packField(pack, FIELD_SHADER_TABLE) + index * SHADER_ENTRY_SIZE];
+}
+
+// FNV-1a hash, used for shader names and for the pack checksum
+static uint32_t fnv1a(const char* data, size_t size) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 16777619u;
 	}
-	return length;
+	return hash;
 }
 
-static void decompress(const char* const compressedText, const char* const token, size_t offset, char* decompressedText, size_t* write_pos) {
-	for (size_t readPos = offset; token[readPos] != '\0'; readPos++) {
-		unsigned char c = (unsigned char)token[readPos];
+#if ENTROPY_CODE
+// Decodes count bytes of Huffman coded data, several symbols per table lookup, returns 0 if the data is invalid
+static int huffmanDecode(const char* read, char* dest, size_t count) {
+	const char* end = dest + count;
+	uint32_t bits = 0;
+	int bitCount = 0;
 
-		if (c == '$') {
-			uint16_t tokenOffset = (uint8_t)token[readPos + 1] | ((uint8_t)token[readPos + 2] << 8);
-			readPos += 2;
+	while (dest < end) {
+		while (bitCount <= 24) {
+			bits |= (uint32_t)(unsigned char)*read++ << bitCount;
+			bitCount += 8;
+		}
 
-			size_t tokenLength = tknlen(&token[tokenOffset]);
-			if (*write_pos + tokenLength >= MAX_OUTPUT_SIZE) {
-				fprintf(stderr, "Error: Output buffer overflow\n");
-				return;
+		uint32_t entry = huffmanLookup[bits & ((1u << HUFFMAN_TABLE_BITS) - 1)];
+		uint32_t symbols = (entry >> 4) & 3;
+		if (symbols) {
+			uint32_t k;
+			for (k = 0; k < symbols && dest < end; k++) {
+				*dest++ = (char)(entry >> (8 + 8 * k));
 			}
-			
-			decompress(compressedText, &compressedText[tokenOffset], 0, decompressedText, write_pos);
+			bits >>= entry & 15;
+			bitCount -= entry & 15;
 		}
-		else if (c >= 128) {
-			size_t tokenLength = tknlen(tokens[c - 128]);
-			if (*write_pos + tokenLength >= MAX_OUTPUT_SIZE) {
-				fprintf(stderr, "Error: Output buffer overflow\n");
-				return;
-			}
+		else {
+			// Codes longer than the lookup are decoded one bit at a time
+			uint32_t code = 0;
+			int length = 0;
+			do {
+				code = (code << 1) | (bits & 1);
+				bits >>= 1;
+				bitCount--;
+				length++;
+			} while (code - huffmanFirst[length] >= huffmanCount[length] && length < HUFFMAN_MAX_LENGTH);
 
-			decompress(compressedText, tokens[c - 128], 0, decompressedText, write_pos);
+			if (code - huffmanFirst[length] >= huffmanCount[length]) return 0;
+			*dest++ = (char)huffmanSymbols[huffmanIndex[length] + code - huffmanFirst[length]];
 		}
-		else {
+	}
+	return 1;
+}
+#endif
+
+// Returns where the shader at the given offset is read from, or NULL if it is invalid. Entropy coded shaders
+// are first decoded at the end of the output buffer: every byte read expands to at least one byte,
+// so expanding their tokens from there never overwrites what is still to be read.
+static const char* shaderStream(const char* const pack, size_t offset, char* buffer, size_t capacity) {
+#if ENTROPY_CODE
+	size_t count = readU32(&pack[offset]);
+	size_t length = readU32(&pack[offset + 4]);
+	if (length > capacity || count + packField(pack, FIELD_VERSION_LENGTH) > length + 1) return NULL;
+
+	char* stream = &buffer[capacity + 1 - count];
+	if (!huffmanDecode(&pack[offset + ENTROPY_PREFIX_SIZE], stream, count)) return NULL;
+	return stream;
+#else
+	(void)buffer;
+	(void)capacity;
+	return &pack[offset];
+#endif
+}
+
+static int decompress(const char* const pack, const char* read, char* decompressedText, size_t* write_pos, size_t capacity) {
+	const char* charTokens = &pack[packField(pack, FIELD_CHAR_TOKEN_TABLE)];
+	const char* packTokens = &pack[packField(pack, FIELD_PACK_TOKEN_TABLE)];
+
+	// Return addresses of the tokens being expanded
+	const char* stack[MAX_TOKEN_DEPTH];
+	size_t depth = 0;
+	int success = 1;
+
+	for (;;) {
+		unsigned char c = (unsigned char)*read++;
+		const char* token;
+
+		if (c == '\0') {
+			if (depth == 0) break;
+			read = stack[--depth];
+			continue;
+		}
+		else if (c == '$') {
+			uint16_t tokenIndex = (uint8_t)read[0] | ((uint8_t)read[1] << 8);
+			read += 2;
+			token = &packTokens[tokenIndex * TOKEN_ENTRY_SIZE];
+		}
+		else if (c >= 128) {
+			token = &charTokens[(c - 128) * TOKEN_ENTRY_SIZE];
+		}
+		else if (*write_pos < capacity) {
 			decompressedText[(*write_pos)++] = c;
+			continue;
+		}
+		else {
+			success = 0;
+			break;
+		}
+
+		if (*write_pos + readU32(token + 4) > capacity || depth == MAX_TOKEN_DEPTH) {
+			success = 0;
+			break;
 		}
+
+		stack[depth++] = read;
+		read = &pack[readU32(token)];
 	}
 	decompressedText[*write_pos] = '\0';
+	return success;
+}
+
+int verifyShaderPack(const char* const pack, size_t size) {
+	if (size < HEADER_SIZE) return 0;
+	if (packField(pack, FIELD_MAGIC) != SHADER_PACK_MAGIC || packField(pack, FIELD_FORMAT) != SHADER_PACK_FORMAT) return 0;
+	if (packField(pack, FIELD_SIZE) != size || packField(pack, FIELD_MAX_TOKEN_DEPTH) > MAX_TOKEN_DEPTH) return 0;
+	if (packField(pack, FIELD_ENTROPY_CODE) != ENTROPY_CODE) return 0;
+
+	// Tables are stored in this order, right after the header
+	if (packField(pack, FIELD_SHADER_TABLE) != HEADER_SIZE
+		|| packField(pack, FIELD_BUCKET_TABLE) != HEADER_SIZE + (uint64_t)packField(pack, FIELD_SHADER_COUNT) * SHADER_ENTRY_SIZE
+		|| packField(pack, FIELD_CHAR_TOKEN_TABLE) != packField(pack, FIELD_BUCKET_TABLE) + (uint64_t)packField(pack, FIELD_BUCKET_COUNT) * 4
+		|| packField(pack, FIELD_PACK_TOKEN_TABLE) != packField(pack, FIELD_CHAR_TOKEN_TABLE) + (uint64_t)packField(pack, FIELD_CHAR_TOKEN_COUNT) * TOKEN_ENTRY_SIZE
+		|| packField(pack, FIELD_PACK_TOKEN_TABLE) + (uint64_t)packField(pack, FIELD_PACK_TOKEN_COUNT) * TOKEN_ENTRY_SIZE > size) {
+		return 0;
+	}
+
+	return fnv1a(&pack[FIELD_SHADER_COUNT * 4], size - FIELD_SHADER_COUNT * 4) == packField(pack, FIELD_CHECKSUM);
+}
+
+size_t getShaderCount(const char* const pack) {
+	return packField(pack, FIELD_SHADER_COUNT);
+}
+
+size_t getShadersTotalLength(const char* const pack) {
+	return packField(pack, FIELD_TOTAL_LENGTH);
+}
+
+size_t getShaderOffset(const char* const pack, size_t index) {
+	return readU32(shaderEntry(pack, index) + 8);
+}
+
+size_t getShaderLength(const char* const pack, size_t index) {
+	return readU32(shaderEntry(pack, index) + 12);
+}
+
+size_t findShader(const char* const pack, const char* name) {
+	uint32_t hash = fnv1a(name, strlen(name));
+	uint32_t mask = packField(pack, FIELD_BUCKET_COUNT) - 1;
+	const char* buckets = &pack[packField(pack, FIELD_BUCKET_TABLE)];
+
+	// Open addressing with linear probing, the table is never more than half full
+	for (uint32_t bucket = hash & mask;; bucket = (bucket + 1) & mask) {
+		uint32_t entry = readU32(&buckets[bucket * 4]);
+		if (entry == 0) return SHADER_NOT_FOUND;
+
+		const char* shader = shaderEntry(pack, entry - 1);
+		if (readU32(shader) == hash && strcmp(&pack[readU32(shader + 4)], name) == 0) return entry - 1;
+	}
 }
 
 char* getShaderSourceFromFile(const char* const compressedText, size_t offset) {
-	char* decompressedText = (char*)malloc(MAX_OUTPUT_SIZE + 1);
+	size_t capacity = packField(compressedText, FIELD_MAX_LENGTH);
+	size_t versionLength = packField(compressedText, FIELD_VERSION_LENGTH);
+
+	char* decompressedText = (char*)malloc(capacity + 1);
 	if (!decompressedText) {
 		fprintf(stderr, "Memory allocation error\n");
 		return NULL;
 	}
 	
-	strncpy(decompressedText, version, VERSION_LENGTH);
-	decompressedText[VERSION_LENGTH] = '\0';
+	memcpy(decompressedText, &compressedText[packField(compressedText, FIELD_VERSION_OFFSET)], versionLength);
 
-	size_t write_pos = VERSION_LENGTH;
-	decompress(compressedText, compressedText, offset, decompressedText, &write_pos);
+	size_t write_pos = versionLength;
+	const char* stream = shaderStream(compressedText, offset, decompressedText, capacity);
+	if (!stream) {
+		fprintf(stderr, "Error: Invalid shader data\n");
+		decompressedText[write_pos] = '\0';
+	}
+	else if (!decompress(compressedText, stream, decompressedText, &write_pos, capacity)) {
+		fprintf(stderr, "Error: Output buffer overflow\n");
+	}
 	
 	return decompressedText;
+}
+
+size_t unpackShader(const char* const compressedText, size_t offset, char* buffer, size_t bufferSize) {
+	size_t versionLength = packField(compressedText, FIELD_VERSION_LENGTH);
+	if (bufferSize < versionLength + 1) return 0;
+
+	memcpy(buffer, &compressedText[packField(compressedText, FIELD_VERSION_OFFSET)], versionLength);
+
+	size_t write_pos = versionLength;
+	const char* stream = shaderStream(compressedText, offset, buffer, bufferSize - 1);
+	if (!stream || !decompress(compressedText, stream, buffer, &write_pos, bufferSize - 1)) {
+		buffer[0] = '\0';
+		return 0;
+	}
+
+	return write_pos;
+}
+
+// Copies a text to dest, token references being replaced by their expansion already in the cache
+static char* expandFromCache(const char* const pack, const char* read, char* dest, const char* cache, const size_t* charPositions, const size_t* packPositions) {
+	const char* charTokens = &pack[packField(pack, FIELD_CHAR_TOKEN_TABLE)];
+	const char* packTokens = &pack[packField(pack, FIELD_PACK_TOKEN_TABLE)];
+
+	for (;;) {
+		unsigned char c = (unsigned char)*read++;
+
+		if (c == '\0') {
+			return dest;
+		}
+		else if (c == '$') {
+			uint16_t tokenIndex = (uint8_t)read[0] | ((uint8_t)read[1] << 8);
+			read += 2;
+
+			uint32_t length = readU32(&packTokens[tokenIndex * TOKEN_ENTRY_SIZE + 4]);
+			memcpy(dest, &cache[packPositions[tokenIndex]], length);
+			dest += length;
+		}
+		else if (c >= 128) {
+			uint32_t length = readU32(&charTokens[(c - 128) * TOKEN_ENTRY_SIZE + 4]);
+			memcpy(dest, &cache[charPositions[c - 128]], length);
+			dest += length;
+		}
+		else {
+			*dest++ = c;
+		}
+	}
+}
+
+int unpackAllShaders(const char* const compressedText, char* buffer, size_t bufferSize, const char** sources) {
+	if (bufferSize < packField(compressedText, FIELD_TOTAL_LENGTH)) return 0;
+
+	size_t charTokenCount = packField(compressedText, FIELD_CHAR_TOKEN_COUNT);
+	size_t packTokenCount = packField(compressedText, FIELD_PACK_TOKEN_COUNT);
+	const char* charTokens = &compressedText[packField(compressedText, FIELD_CHAR_TOKEN_TABLE)];
+	const char* packTokens = &compressedText[packField(compressedText, FIELD_PACK_TOKEN_TABLE)];
+
+	// Tokens only reference tokens found before them, so expanding them in order only needs copies from the cache
+	size_t* positions = (size_t*)malloc((charTokenCount + packTokenCount) * sizeof(size_t) + packField(compressedText, FIELD_TOKEN_CACHE_SIZE) + 1);
+	if (!positions) {
+		fprintf(stderr, "Memory allocation error\n");
+		return 0;
+	}
+
+	size_t* charPositions = positions;
+	size_t* packPositions = positions + charTokenCount;
+	char* cache = (char*)(positions + charTokenCount + packTokenCount);
+	char* write = cache;
+
+	for (size_t i = 0; i < charTokenCount; i++) {
+		charPositions[i] = write - cache;
+		write = expandFromCache(compressedText, &compressedText[readU32(&charTokens[i * TOKEN_ENTRY_SIZE])], write, cache, charPositions, packPositions);
+	}
+	for (size_t i = 0; i < packTokenCount; i++) {
+		packPositions[i] = write - cache;
+		write = expandFromCache(compressedText, &compressedText[readU32(&packTokens[i * TOKEN_ENTRY_SIZE])], write, cache, charPositions, packPositions);
+	}
+
+	const char* version = &compressedText[packField(compressedText, FIELD_VERSION_OFFSET)];
+	size_t versionLength = packField(compressedText, FIELD_VERSION_LENGTH);
+
+	write = buffer;
+	for (size_t i = 0; i < packField(compressedText, FIELD_SHADER_COUNT); i++) {
+		const char* stream = shaderStream(compressedText, getShaderOffset(compressedText, i), write, getShaderLength(compressedText, i));
+		if (!stream) {
+			free(positions);
+			return 0;
+		}
+
+		sources[i] = write;
+		memcpy(write, version, versionLength);
+		write = expandFromCache(compressedText, stream, write + versionLength, cache, charPositions, packPositions);
+		*write++ = '\0';
+	}
+
+	free(positions);
+	return 1;
 })";
 
+// Function to compute the expanded length and nesting depth of a text, using the expansion of the tokens it references
+size_t expandedLength(const std::string& text, const TokenExpansion& expansion, size_t* depth) {
+	size_t length = 0;
+	size_t nesting = 0;
+	for (size_t i = 0; i < text.size(); i++) {
+		unsigned char c = static_cast<unsigned char>(text[i]);
+
+		if (c == '$' && i + 2 < text.size()) {
+			size_t tokenIndex = static_cast<uint8_t>(text[i + 1]) | (static_cast<uint8_t>(text[i + 2]) << 8);
+			if (tokenIndex >= expansion.packLengths.size()) {
+				throw std::runtime_error("Token list malformed");
+			}
+			length += expansion.packLengths[tokenIndex];
+			nesting = std::max(nesting, expansion.packDepths[tokenIndex]);
+			i += 2;
+		}
+		else if (c >= 128) {
+			if (c - 128u >= expansion.charLengths.size()) {
+				throw std::runtime_error("Token list malformed");
+			}
+			length += expansion.charLengths[c - 128];
+			nesting = std::max(nesting, expansion.charDepths[c - 128]);
+		}
+		else {
+			length++;
+		}
+	}
+
+	if (depth) *depth = nesting;
+	return length;
+}
+
+// Function to compute the expanded length of every token, tokens only reference tokens found before them
+TokenExpansion expandTokens(
+	const std::unordered_map<uint8_t, std::string>& tokenCharMap,
+	const std::unordered_map<uint16_t, std::string>& tokenList
+) {
+	TokenExpansion expansion;
+	size_t depth;
+
+	for (size_t i = 128; i <= 255 && tokenCharMap.find((uint8_t)i) != tokenCharMap.end(); i++) {
+		expansion.charLengths.push_back(expandedLength(tokenCharMap.at((uint8_t)i), expansion, &depth));
+		expansion.charDepths.push_back(depth + 1);
+		expansion.maxDepth = std::max(expansion.maxDepth, depth + 1);
+	}
+
+	for (size_t i = 0; i < tokenList.size(); i++) {
+		if (tokenList.find((uint16_t)i) == tokenList.end()) {
+			throw std::runtime_error("Token list malformed");
+		}
+
+		expansion.packLengths.push_back(expandedLength(tokenList.at((uint16_t)i), expansion, &depth));
+		expansion.packDepths.push_back(depth + 1);
+		expansion.maxDepth = std::max(expansion.maxDepth, depth + 1);
+	}
+
+	return expansion;
+}
+
+// Function to write an unsigned 32-bit little-endian value into the pack
+static void writeU32(std::vector<uint8_t>& pack, size_t position, size_t value) {
+	if (value > std::numeric_limits<uint32_t>::max()) {
+		throw std::runtime_error("Error: Pack too large (" + std::to_string(value) + " exceeds 32 bits).");
+	}
+	for (size_t i = 0; i < 4; i++) {
+		pack[position + i] = static_cast<uint8_t>(value >> (8 * i));
+	}
+}
+
+// Function to write a table of unsigned values as a C array
+static void writeTable(std::ostringstream& content, const std::string& type, const std::string& name, const std::vector<uint32_t>& values) {
+	content << "static const " << type << " " << name << "[] = {";
+	for (size_t i = 0; i < values.size(); i++) {
+		if (i % 16 == 0) content << std::endl << "\t";
+		content << values[i] << (i + 1 < values.size() ? ", " : "");
+	}
+	content << std::endl << "};" << std::endl << std::endl;
+}
+
+// Function to write the pack as a C array, aligned for its 32-bit fields and kept in read-only data
+static void writeEmbeddedPack(std::ostringstream& content, const std::vector<uint8_t>& pack) {
+	content << "// The pack, embedded so that it is never read from a file" << std::endl;
+	content << "#ifdef __cplusplus" << std::endl << "#define SHADER_PACK_ALIGNED alignas(16)" << std::endl;
+	content << "#else" << std::endl << "#define SHADER_PACK_ALIGNED _Alignas(16)" << std::endl << "#endif" << std::endl;
+	content << "SHADER_PACK_ALIGNED static const unsigned char shaderPack[" << pack.size() << "] = {";
+	for (size_t i = 0; i < pack.size(); i++) {
+		if (i % 24 == 0) content << std::endl << "\t";
+		content << (unsigned)pack[i] << (i + 1 < pack.size() ? "," : "");
+	}
+	content << std::endl << "};" << std::endl << std::endl;
+}
+
+// Accessors of the embedded pack, appended to the decompressor
+static constexpr std::string_view embeddedPackSrc = R"(
+const char* getShaderPack(void) {
+	return (const char*)shaderPack;
+}
+
+char* getEmbeddedShaderSource(size_t offset) {
+	return getShaderSourceFromFile((const char*)shaderPack, offset);
+}
+
+size_t unpackEmbeddedShader(size_t offset, char* buffer, size_t bufferSize) {
+	return unpackShader((const char*)shaderPack, offset, buffer, bufferSize);
+}
+
+int unpackAllEmbeddedShaders(char* buffer, size_t bufferSize, const char** sources) {
+	return unpackAllShaders((const char*)shaderPack, buffer, bufferSize, sources);
+}
+)";
+
+// Accessor unpacking each shader once, appended to the decompressor. Shaders are unpacked outside of any lock:
+// threads asking for the same shader at the same time may both unpack it, only the first copy stored is kept.
+static constexpr std::string_view cachedAccessorSrc = R"(
+static const char* cachedPack = SHADER_CACHE_PACK;
+static SHADER_ATOMIC_SOURCE cachedSources[SHADER_CACHE_COUNT];
+
+void setShaderSourcePack(const char* pack) {
+	cachedPack = pack;
+}
+
+const char* getShaderSource(size_t index) {
+	const char* pack = cachedPack;
+	if (!pack || index >= SHADER_CACHE_COUNT || index >= getShaderCount(pack)) return NULL;
+
+	const char* source = atomic_load_explicit(&cachedSources[index], memory_order_acquire);
+	if (source) return source;
+
+	size_t length = getShaderLength(pack, index);
+	char* buffer = (char*)malloc(length + 1);
+	if (!buffer) {
+		fprintf(stderr, "Memory allocation error\n");
+		return NULL;
+	}
+	if (unpackShader(pack, getShaderOffset(pack, index), buffer, length + 1) != length) {
+		free(buffer);
+		return NULL;
+	}
+
+	const char* expected = NULL;
+	if (!atomic_compare_exchange_strong_explicit(&cachedSources[index], &expected, (const char*)buffer, memory_order_acq_rel, memory_order_acquire)) {
+		free(buffer);
+		return expected;
+	}
+	return buffer;
+}
+
+void releaseShaderSources(void) {
+	for (size_t i = 0; i < SHADER_CACHE_COUNT; i++) {
+		free((char*)atomic_load_explicit(&cachedSources[i], memory_order_acquire));
+		atomic_store_explicit(&cachedSources[i], (const char*)NULL, memory_order_release);
+	}
+}
+)";
+
+// Function to strip the directories from a shader path, giving the name it is looked up by
+static std::string shaderFileName(const std::string& name) {
+	size_t begin = name.find_last_of("/\\");
+	return begin == std::string::npos ? name : name.substr(begin + 1);
+}
+
+// Function to derive the C identifier of a shader from its file path
+static std::string shaderIdentifier(const std::string& name) {
+	size_t pos1 = name.find_last_of('/');
+	pos1 = (pos1 == std::string::npos) ? 0 : pos1;
+	size_t pos2 = name.find_last_of('\\');
+	pos2 = (pos2 == std::string::npos) ? 0 : pos2;
+	size_t begin = std::max(pos1, pos2) + 1;
+
+	return "shader_" + name.substr(begin, name.find_last_of('.') - begin);
+}
+
 // Function to generate header file for shaders
 std::string generateHeader(
 	const std::unordered_map<std::string, std::string>& variableMap,
-	const std::vector<std::pair<std::string, size_t>>& shaderOffsets
+	const std::vector<std::pair<std::string, size_t>>& shaderOffsets,
+	const std::vector<size_t>& shaderLengths,
+	const RuntimeOptions& runtime
 ) {
 	std::ostringstream headerContent;
 
@@ -78,18 +529,29 @@ std::string generateHeader(
 
 	headerContent << "enum ShaderOffset {" << std::endl;
 	for (const auto& [name, offset] : shaderOffsets) {
-		size_t pos1 = name.find_last_of('/');
-		pos1 = (pos1 == std::string::npos) ? 0 : pos1;
-		size_t pos2 = name.find_last_of('\\');
-		pos2 = (pos2 == std::string::npos) ? 0 : pos2;
-		size_t begin = std::max(pos1, pos2) + 1;
+		headerContent << "\t" << shaderIdentifier(name) << " = " << std::to_string(offset) << "," << std::endl;
+	}
+	headerContent << "};" << std::endl << std::endl;
 
-		std::string processedName = "shader_" + name.substr(begin, name.find_last_of('.') - begin);
+	// Exact length of each unpacked shader, version directive included and terminating NUL excluded
+	size_t totalLength = 0;
+	headerContent << "enum ShaderLength {" << std::endl;
+	for (size_t i = 0; i < shaderOffsets.size(); i++) {
+		headerContent << "\t" << shaderIdentifier(shaderOffsets[i].first) << "_length = " << std::to_string(shaderLengths[i]) << "," << std::endl;
+		totalLength += shaderLengths[i] + 1;
+	}
+	headerContent << "};" << std::endl << std::endl;
 
-		headerContent << "\t" << processedName << " = " << std::to_string(offset) << "," << std::endl;
+	// Position of each shader in the pack, as filled by unpackAllShaders
+	headerContent << "enum ShaderIndex {" << std::endl;
+	for (size_t i = 0; i < shaderOffsets.size(); i++) {
+		headerContent << "\t" << shaderIdentifier(shaderOffsets[i].first) << "_index = " << std::to_string(i) << "," << std::endl;
 	}
 	headerContent << "};" << std::endl << std::endl;
 
+	headerContent << "#define SHADER_COUNT " << std::to_string(shaderOffsets.size()) << std::endl;
+	headerContent << "#define SHADERS_TOTAL_LENGTH " << std::to_string(totalLength) << std::endl << std::endl;
+
 	for (const auto& [original, minified] : variableMap) {
 		if (minified[0] == 'u') {
 			headerContent << "extern const char* uniform_" << original << ";" << std::endl;
@@ -97,17 +559,54 @@ std::string generateHeader(
 	}
 
 	headerContent << std::endl;
-	headerContent << "char* getShaderSourceFromFile(const char* compressedText, size_t offset);" << std::endl;
+	headerContent << "char* getShaderSourceFromFile(const char* compressedText, size_t offset);" << std::endl << std::endl;
+
+	headerContent << "// Unpacks a shader into a buffer of at least its length + 1 bytes, returns its length or 0 if the buffer is too small" << std::endl;
+	headerContent << "size_t unpackShader(const char* compressedText, size_t offset, char* buffer, size_t bufferSize);" << std::endl << std::endl;
+
+	headerContent << "// Unpacks every shader into a buffer of at least SHADERS_TOTAL_LENGTH bytes, expanding each token only once," << std::endl;
+	headerContent << "// sources receives SHADER_COUNT pointers in ShaderIndex order, returns 0 on failure" << std::endl;
+	headerContent << "int unpackAllShaders(const char* compressedText, char* buffer, size_t bufferSize, const char** sources);" << std::endl << std::endl;
+
+	headerContent << "// The pack describes itself, so these also work on a pack generated after this file" << std::endl;
+	headerContent << "#define SHADER_NOT_FOUND ((size_t)-1)" << std::endl << std::endl;
+
+	headerContent << "// Checks the header, size and checksum of a pack before use, returns 0 if it is invalid" << std::endl;
+	headerContent << "int verifyShaderPack(const char* pack, size_t size);" << std::endl;
+	headerContent << "size_t getShaderCount(const char* pack);" << std::endl;
+	headerContent << "size_t getShadersTotalLength(const char* pack);" << std::endl;
+	headerContent << "// Returns the index of a shader from its file name without directories, or SHADER_NOT_FOUND" << std::endl;
+	headerContent << "size_t findShader(const char* pack, const char* name);" << std::endl;
+	headerContent << "size_t getShaderOffset(const char* pack, size_t index);" << std::endl;
+	headerContent << "size_t getShaderLength(const char* pack, size_t index);" << std::endl;
+
+	if (runtime.embeddedPack) {
+		headerContent << std::endl << "// The pack is embedded in the C file, these functions use it without loading any file" << std::endl;
+		headerContent << "#define SHADER_PACK_SIZE " << std::to_string(runtime.embeddedPack->size()) << std::endl;
+		headerContent << "const char* getShaderPack(void);" << std::endl;
+		headerContent << "char* getEmbeddedShaderSource(size_t offset);" << std::endl;
+		headerContent << "size_t unpackEmbeddedShader(size_t offset, char* buffer, size_t bufferSize);" << std::endl;
+		headerContent << "int unpackAllEmbeddedShaders(char* buffer, size_t bufferSize, const char** sources);" << std::endl;
+	}
+
+	if (runtime.cachedShaders > 0) {
+		headerContent << std::endl << "// Returns a shader by ShaderIndex, unpacked on first use and kept until releaseShaderSources, or NULL on failure." << std::endl;
+		headerContent << "// Safe to call from any thread." << (runtime.embeddedPack ? "" : " The pack must be given once before, and outlive the shaders.") << std::endl;
+		if (!runtime.embeddedPack) headerContent << "void setShaderSourcePack(const char* pack);" << std::endl;
+		headerContent << "const char* getShaderSource(size_t index);" << std::endl;
+		headerContent << "// Frees the unpacked shaders, while no thread uses them" << std::endl;
+		headerContent << "void releaseShaderSources(void);" << std::endl;
+	}
 
 	return headerContent.str();
 }
 
 // Function to generate the C file content for shaders
 std::string generateCFile(
-	const std::unordered_map<uint8_t, std::string>& tokenCharMap,
 	const std::unordered_map<std::string, std::string>& variableMap,
-	const std::string& glslVersion,
-	size_t maxOutputSize
+	size_t maxTokenDepth,
+	const HuffmanCode* entropyCode,
+	const RuntimeOptions& runtime
 ) {
 	std::ostringstream cFileContent;
 
@@ -116,76 +615,27 @@ std::string generateCFile(
 	cFileContent << "#include <string.h>" << std::endl;
 	cFileContent << "#include <stdio.h>" << std::endl << std::endl;
 
-	cFileContent << "#define MAX_OUTPUT_SIZE " << std::to_string(maxOutputSize + glslVersion.length() + 2) << std::endl;
-	cFileContent << "#define VERSION_LENGTH " << std::to_string(glslVersion.length() + 1) << std::endl << std::endl;
+	cFileContent << "#define SHADER_PACK_MAGIC " << std::to_string(PACK_MAGIC) << "u" << std::endl;
+	cFileContent << "#define SHADER_PACK_FORMAT " << std::to_string(PACK_FORMAT) << std::endl;
+	cFileContent << "#define SHADER_NOT_FOUND ((size_t)-1)" << std::endl;
+	cFileContent << "#define MAX_TOKEN_DEPTH " << std::to_string(std::max(maxTokenDepth, MIN_TOKEN_DEPTH)) << std::endl;
 
-	cFileContent << "const char* version = \"" << glslVersion << "\\n\";" << std::endl << std::endl;
+	if (entropyCode) {
+		HuffmanDecoder decoder = make_huffman_decoder(*entropyCode);
 
-	cFileContent << "const char* tokens[] = {" << std::endl;
-	for (uint8_t i = 128; i <= 255; i++) {
-		if (tokenCharMap.find(i) != tokenCharMap.end()) {
-			cFileContent << "\t\"";
-	
-			const std::string &str = tokenCharMap.at(i);
-			for (size_t j = 0; j < str.size(); ++j) {
-				unsigned char c = static_cast<unsigned char>(str[j]);
-	
-				// If the character is printable and not a special escape character
-				if (isprint(c) && c != '\"' && c != '\\') {
-					cFileContent << c;
-				}
-				else {
-					switch (c) {
-						case '\"':
-							cFileContent << "\\\"";
-							break;
-						case '\\':
-							cFileContent << "\\\\";
-							break;
-						case '\n':
-							cFileContent << "\\n";
-							break;
-						case '\r':
-							cFileContent << "\\r";
-							break;
-						case '\t':
-							cFileContent << "\\t";
-							break;
-						case '\b':
-							cFileContent << "\\b";
-							break;
-						case '\f':
-							cFileContent << "\\f";
-							break;
-						case '\a':
-							cFileContent << "\\a";
-							break;
-						case '\v':
-							cFileContent << "\\v";
-							break;
-						default:
-							cFileContent << "\\x"
-								<< std::hex << std::uppercase
-								<< std::setw(2) << std::setfill('0')
-								<< static_cast<int>(c);
-			
-							if (j + 1 < str.size()) {
-								unsigned char next = static_cast<unsigned char>(str[j + 1]);
-								if (std::isxdigit(next)) {
-									cFileContent << "\"\"";
-								}
-							}
-			
-							cFileContent << std::dec;
-							break;
-					}
-				}
-			}
-	
-			cFileContent << "\"," << std::endl;
-		} else break;
+		cFileContent << "#define ENTROPY_CODE " << std::to_string(huffman_code_hash(*entropyCode)) << "u" << std::endl;
+		cFileContent << "#define HUFFMAN_TABLE_BITS " << std::to_string(HUFFMAN_TABLE_BITS) << std::endl;
+		cFileContent << "#define HUFFMAN_MAX_LENGTH " << std::to_string(HUFFMAN_MAX_LENGTH) << std::endl << std::endl;
+
+		writeTable(cFileContent, "uint32_t", "huffmanLookup", decoder.lookup);
+		writeTable(cFileContent, "uint32_t", "huffmanFirst", std::vector<uint32_t>(decoder.first.begin(), decoder.first.end()));
+		writeTable(cFileContent, "uint32_t", "huffmanCount", std::vector<uint32_t>(decoder.count.begin(), decoder.count.end()));
+		writeTable(cFileContent, "uint32_t", "huffmanIndex", std::vector<uint32_t>(decoder.index.begin(), decoder.index.end()));
+		writeTable(cFileContent, "uint8_t", "huffmanSymbols", std::vector<uint32_t>(decoder.symbols.begin(), decoder.symbols.end()));
+	}
+	else {
+		cFileContent << "#define ENTROPY_CODE 0" << std::endl << std::endl;
 	}
-	cFileContent << "};" << std::endl << std::endl;
 
 	for (const auto& [original, minified] : variableMap) {
 		if (minified[0] == 'u') {
@@ -195,37 +645,161 @@ std::string generateCFile(
 
 	cFileContent << std::endl;
 
+	if (runtime.embeddedPack) {
+		writeEmbeddedPack(cFileContent, *runtime.embeddedPack);
+	}
+
 	cFileContent << getShaderSourceFromFileSrc << std::endl;
 
+	if (runtime.embeddedPack) {
+		cFileContent << embeddedPackSrc;
+	}
+
+	if (runtime.cachedShaders > 0) {
+		cFileContent << std::endl << "#ifdef __cplusplus" << std::endl << "#include <atomic>" << std::endl;
+		cFileContent << "using std::atomic_load_explicit;" << std::endl << "using std::atomic_store_explicit;" << std::endl;
+		cFileContent << "using std::atomic_compare_exchange_strong_explicit;" << std::endl;
+		cFileContent << "using std::memory_order_acquire;" << std::endl << "using std::memory_order_release;" << std::endl << "using std::memory_order_acq_rel;" << std::endl;
+		cFileContent << "#define SHADER_ATOMIC_SOURCE std::atomic<const char*>" << std::endl;
+		cFileContent << "#else" << std::endl << "#include <stdatomic.h>" << std::endl;
+		cFileContent << "#define SHADER_ATOMIC_SOURCE _Atomic(const char*)" << std::endl << "#endif" << std::endl << std::endl;
+		cFileContent << "#define SHADER_CACHE_COUNT " << runtime.cachedShaders << std::endl;
+		cFileContent << "#define SHADER_CACHE_PACK " << (runtime.embeddedPack ? "(const char*)shaderPack" : "NULL") << std::endl;
+		cFileContent << cachedAccessorSrc;
+	}
+
 	return cFileContent.str();
 }
 
 // Function to generate packed content for shaders
 std::vector<uint8_t> generatePackedContent(
 	const std::unordered_map<std::string, std::string>& shaders,
+	const std::unordered_map<uint8_t, std::string>& tokenCharMap,
 	const std::unordered_map<uint16_t, std::string>& tokenList,
-	std::vector<std::pair<std::string, size_t>>& shadersOffsets
+	const TokenExpansion& expansion,
+	const std::string& glslVersion,
+	const HuffmanCode* entropyCode,
+	std::vector<std::pair<std::string, size_t>>& shadersOffsets,
+	std::vector<size_t>& shaderLengths,
+	const std::unordered_map<std::string, std::string>& aliases
 ) {
-	std::vector<uint8_t> packedContent;
-	size_t currentOffset = 0;
+	const size_t shaderCount = shaders.size() + aliases.size();
+	const size_t charTokenCount = expansion.charLengths.size();
+	const size_t packTokenCount = expansion.packLengths.size();
 
-	for (int i = 0; i < tokenList.size(); i++) {
-		if (tokenList.find((uint16_t)currentOffset) == tokenList.end()) {
-			throw std::runtime_error("Token list malformed");
-		}
+	// Name lookups probe a power of two number of buckets, at most half of them used
+	size_t bucketCount = 1;
+	while (bucketCount < shaderCount * 2) bucketCount *= 2;
 
-		std::string token = tokenList.at((uint16_t)currentOffset);
-		packedContent.insert(packedContent.end(), token.begin(), token.end());
+	const size_t shaderTable = HEADER_SIZE;
+	const size_t bucketTable = shaderTable + shaderCount * SHADER_ENTRY_SIZE;
+	const size_t charTokenTable = bucketTable + bucketCount * 4;
+	const size_t packTokenTable = charTokenTable + charTokenCount * TOKEN_ENTRY_SIZE;
+
+	std::vector<uint8_t> packedContent(packTokenTable + packTokenCount * TOKEN_ENTRY_SIZE, 0);
+
+	auto append = [&](const std::string& text) {
+		size_t offset = packedContent.size();
+		packedContent.insert(packedContent.end(), text.begin(), text.end());
 		packedContent.push_back('\0');
-		currentOffset += token.size() + 1;
+		return offset;
+	};
+
+	const std::string versionLine = glslVersion + "\n";
+	writeU32(packedContent, FIELD_VERSION_OFFSET * 4, append(versionLine));
+	writeU32(packedContent, FIELD_VERSION_LENGTH * 4, versionLine.size());
+
+	for (size_t i = 0; i < charTokenCount; i++) {
+		size_t entry = charTokenTable + i * TOKEN_ENTRY_SIZE;
+		writeU32(packedContent, entry, append(tokenCharMap.at((uint8_t)(128 + i))));
+		writeU32(packedContent, entry + 4, expansion.charLengths[i]);
+	}
+
+	for (size_t i = 0; i < packTokenCount; i++) {
+		size_t entry = packTokenTable + i * TOKEN_ENTRY_SIZE;
+		writeU32(packedContent, entry, append(tokenList.at((uint16_t)i)));
+		writeU32(packedContent, entry + 4, expansion.packLengths[i]);
 	}
 
+	size_t maxLength = 0, totalLength = 0, index = 0;
+	auto addEntry = [&](const std::string& name, size_t offset, size_t length) {
+		std::string fileName = shaderFileName(name);
+		uint32_t hash = fnv1a(reinterpret_cast<const uint8_t*>(fileName.data()), fileName.size());
+
+		size_t entry = shaderTable + index * SHADER_ENTRY_SIZE;
+		writeU32(packedContent, entry, hash);
+		writeU32(packedContent, entry + 4, append(fileName));
+		writeU32(packedContent, entry + 8, offset);
+		writeU32(packedContent, entry + 12, length);
+
+		size_t bucket = hash & (bucketCount - 1);
+		while (packedContent[bucketTable + bucket * 4] | packedContent[bucketTable + bucket * 4 + 1]
+			| packedContent[bucketTable + bucket * 4 + 2] | packedContent[bucketTable + bucket * 4 + 3]) {
+			bucket = (bucket + 1) & (bucketCount - 1);
+		}
+		writeU32(packedContent, bucketTable + bucket * 4, index + 1);
+
+		shadersOffsets.push_back({name, offset});
+		shaderLengths.push_back(length);
+		maxLength = std::max(maxLength, length);
+		totalLength += length + 1;
+		index++;
+	};
+
+	std::unordered_map<std::string, std::pair<size_t, size_t>> streams;
 	for (const auto& [name, text] : shaders) {
-		shadersOffsets.push_back({name, currentOffset});
-		packedContent.insert(packedContent.end(), text.begin(), text.end());
-		packedContent.push_back('\0');
-		currentOffset += text.size() + 1;
+		size_t length = versionLine.size() + expandedLength(text, expansion);
+
+		size_t offset = packedContent.size();
+		if (entropyCode) {
+			std::string stream = text + '\0';
+			packedContent.resize(offset + ENTROPY_PREFIX_SIZE);
+			writeU32(packedContent, offset, stream.size());
+			writeU32(packedContent, offset + 4, length);
+			huffman_encode(stream, *entropyCode, packedContent);
+		}
+		else {
+			append(text);
+		}
+
+		addEntry(name, offset, length);
+		streams[name] = {offset, length};
 	}
 
+	// A shader identical to another one only gets its own entry, pointing to the stream of the other one
+	for (const auto& [name, stored] : aliases) {
+		const auto& [offset, length] = streams.at(stored);
+		addEntry(name, offset, length);
+	}
+
+	if (entropyCode) {
+		packedContent.resize(packedContent.size() + ENTROPY_PADDING, 0);
+	}
+
+	size_t tokenCacheSize = 0;
+	for (size_t length : expansion.charLengths) tokenCacheSize += length;
+	for (size_t length : expansion.packLengths) tokenCacheSize += length;
+
+	writeU32(packedContent, FIELD_MAGIC * 4, PACK_MAGIC);
+	writeU32(packedContent, FIELD_FORMAT * 4, PACK_FORMAT);
+	writeU32(packedContent, FIELD_SIZE * 4, packedContent.size());
+	writeU32(packedContent, FIELD_SHADER_COUNT * 4, shaderCount);
+	writeU32(packedContent, FIELD_SHADER_TABLE * 4, shaderTable);
+	writeU32(packedContent, FIELD_BUCKET_COUNT * 4, bucketCount);
+	writeU32(packedContent, FIELD_BUCKET_TABLE * 4, bucketTable);
+	writeU32(packedContent, FIELD_CHAR_TOKEN_COUNT * 4, charTokenCount);
+	writeU32(packedContent, FIELD_CHAR_TOKEN_TABLE * 4, charTokenTable);
+	writeU32(packedContent, FIELD_PACK_TOKEN_COUNT * 4, packTokenCount);
+	writeU32(packedContent, FIELD_PACK_TOKEN_TABLE * 4, packTokenTable);
+	writeU32(packedContent, FIELD_MAX_TOKEN_DEPTH * 4, expansion.maxDepth);
+	writeU32(packedContent, FIELD_MAX_LENGTH * 4, maxLength);
+	writeU32(packedContent, FIELD_TOTAL_LENGTH * 4, totalLength);
+	writeU32(packedContent, FIELD_TOKEN_CACHE_SIZE * 4, tokenCacheSize);
+	writeU32(packedContent, FIELD_ENTROPY_CODE * 4, entropyCode ? huffman_code_hash(*entropyCode) : 0);
+
+	// The checksum covers everything after itself
+	size_t covered = FIELD_CHECKSUM * 4 + 4;
+	writeU32(packedContent, FIELD_CHECKSUM * 4, fnv1a(packedContent.data() + covered, packedContent.size() - covered));
+
 	return packedContent;
 }
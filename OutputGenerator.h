@@ -5,20 +5,52 @@
 #include <unordered_map>
 #include <vector>
 
+#include "Entropy.h"
+
+// Expanded length and nesting depth of every token, computed once so the decompressor never rescans a token
+struct TokenExpansion {
+	std::vector<size_t> charLengths; // Expanded length of each single-character token, from 128
+	std::vector<size_t> charDepths;
+	std::vector<size_t> packLengths; // Expanded length of each multi-character token, by index
+	std::vector<size_t> packDepths;
+	size_t maxDepth = 1;             // Deepest nesting of tokens, bounds the decompressor stack
+};
+
+TokenExpansion expandTokens(
+	const std::unordered_map<uint8_t, std::string>& tokenCharMap,
+	const std::unordered_map<uint16_t, std::string>& tokenList
+);
+
+size_t expandedLength(const std::string& text, const TokenExpansion& expansion, size_t* depth = nullptr);
+
+// Optional parts of the generated runtime
+struct RuntimeOptions {
+	const std::vector<uint8_t>* embeddedPack = nullptr; // Pack embedded in the C file, if any
+	size_t cachedShaders = 0;                           // Shaders getShaderSource keeps unpacked, 0 for no getShaderSource
+};
+
 std::string generateHeader(
 	const std::unordered_map<std::string, std::string>& variableMap,
-	const std::vector<std::pair<std::string, size_t>>& shaderOffsets
+	const std::vector<std::pair<std::string, size_t>>& shaderOffsets,
+	const std::vector<size_t>& shaderLengths,
+	const RuntimeOptions& runtime = RuntimeOptions()
 );
 
 std::string generateCFile(
-	const std::unordered_map<uint8_t, std::string>& tokenCharMap,
 	const std::unordered_map<std::string, std::string>& variableMap,
-	const std::string& glslVersion,
-	size_t maxOutputSize
+	size_t maxTokenDepth,
+	const HuffmanCode* entropyCode,
+	const RuntimeOptions& runtime = RuntimeOptions()
 );
 
 std::vector<uint8_t> generatePackedContent(
 	const std::unordered_map<std::string, std::string>& shaders,
+	const std::unordered_map<uint8_t, std::string>& tokenCharMap,
 	const std::unordered_map<uint16_t, std::string>& tokenList,
-	std::vector<std::pair<std::string, size_t>>& shadersOffsets
+	const TokenExpansion& expansion,
+	const std::string& glslVersion,
+	const HuffmanCode* entropyCode,
+	std::vector<std::pair<std::string, size_t>>& shadersOffsets,
+	std::vector<size_t>& shaderLengths,
+	const std::unordered_map<std::string, std::string>& aliases = {} // Shaders identical to another one, by name, to the one stored
 );
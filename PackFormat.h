@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Layout of the pack, mirrored by the runtime in OutputGenerator.cpp.
+// A header of PackField values is followed by the shader table, the name hash buckets, the two token tables,
+// then the NUL-terminated version directive, shader names, tokens and shaders. Offsets are from the start of the pack.
+constexpr uint32_t PACK_MAGIC = 0x52434C47; // "GLCR"
+constexpr uint32_t PACK_FORMAT = 2;
+
+enum PackField : size_t {
+	FIELD_MAGIC,
+	FIELD_FORMAT,
+	FIELD_SIZE,
+	FIELD_CHECKSUM,
+	FIELD_SHADER_COUNT,
+	FIELD_SHADER_TABLE,
+	FIELD_BUCKET_COUNT,
+	FIELD_BUCKET_TABLE,
+	FIELD_CHAR_TOKEN_COUNT,
+	FIELD_CHAR_TOKEN_TABLE,
+	FIELD_PACK_TOKEN_COUNT,
+	FIELD_PACK_TOKEN_TABLE,
+	FIELD_MAX_TOKEN_DEPTH,
+	FIELD_MAX_LENGTH,
+	FIELD_TOTAL_LENGTH,
+	FIELD_TOKEN_CACHE_SIZE,
+	FIELD_VERSION_OFFSET,
+	FIELD_VERSION_LENGTH,
+	FIELD_ENTROPY_CODE, // Hash of the Huffman code the shaders are coded with, 0 if they are not
+	HEADER_FIELDS
+};
+
+constexpr size_t HEADER_SIZE = HEADER_FIELDS * 4;
+constexpr size_t SHADER_ENTRY_SIZE = 16; // Name hash, name offset, offset and unpacked length
+constexpr size_t TOKEN_ENTRY_SIZE = 8;   // Offset and expanded length
+
+// Entropy coded shaders start with their coded byte count and unpacked length,
+// and the pack ends with padding so that decoders can read a few bytes ahead
+constexpr size_t ENTROPY_PREFIX_SIZE = 8;
+constexpr size_t ENTROPY_PADDING = 4;
+
+inline uint32_t read_u32(const uint8_t* data) {
+	return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+// FNV-1a hash, used for shader names and for the pack checksum
+inline uint32_t fnv1a(const uint8_t* data, size_t size) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
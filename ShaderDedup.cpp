@@ -0,0 +1,150 @@
+#include "ShaderDedup.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <string_view>
+
+// Bytes near-duplicates must share, below which their prefix and suffix tokens would cost more than they save
+static constexpr size_t MIN_SHARED_BYTES = 64;
+
+// Near-duplicates are looked for among shaders ending, then starting, with the same bytes
+static constexpr size_t KEY_BYTES = 32;
+
+static size_t common_prefix(std::string_view a, std::string_view b, size_t limit) {
+	size_t length = 0;
+	limit = std::min({limit, a.size(), b.size()});
+	while (length < limit && a[length] == b[length]) length++;
+	return length;
+}
+
+static size_t common_suffix(std::string_view a, std::string_view b, size_t limit) {
+	size_t length = 0;
+	limit = std::min({limit, a.size(), b.size()});
+	while (length < limit && a[a.size() - 1 - length] == b[b.size() - 1 - length]) length++;
+	return length;
+}
+
+// Function to find the shaders sharing their content, returning the texts to compress: each distinct shader once,
+// near-duplicates being split into the prefix and suffix they share and their own middle.
+// Shaders are taken in name order, so that the result does not depend on the order of the map.
+std::unordered_map<std::string, std::string> dedup_texts(const std::unordered_map<std::string, std::string>& shaders, ShaderDedup& dedup) {
+	dedup = ShaderDedup();
+
+	std::vector<const std::string*> names;
+	for (const auto& [name, text] : shaders) names.push_back(&name);
+	std::sort(names.begin(), names.end(), [](const std::string* a, const std::string* b) { return *a < *b; });
+
+	// Identical shaders are stored once
+	std::unordered_map<std::string_view, const std::string*> stored;
+	std::vector<const std::string*> distinct;
+	for (const std::string* name : names) {
+		auto [it, inserted] = stored.emplace(shaders.at(*name), name);
+		if (inserted) distinct.push_back(name);
+		else dedup.aliases[*name] = *it->second;
+	}
+
+	std::unordered_map<std::string, std::string> texts;
+	std::vector<bool> grouped(distinct.size(), false);
+
+	for (bool bySuffix : {true, false}) {
+		std::map<std::string_view, std::vector<size_t>> buckets;
+		for (size_t i = 0; i < distinct.size(); i++) {
+			std::string_view text = shaders.at(*distinct[i]);
+			if (grouped[i] || text.size() < MIN_SHARED_BYTES) continue;
+			buckets[bySuffix ? text.substr(text.size() - KEY_BYTES) : text.substr(0, KEY_BYTES)].push_back(i);
+		}
+
+		for (auto& [key, bucket] : buckets) {
+			// Each group starts from the first shader left, and takes the others as long as their middle stays smaller
+			// than what all the members share
+			while (bucket.size() >= 2) {
+				std::string_view base = shaders.at(*distinct[bucket[0]]);
+				size_t prefix = base.size(), suffix = base.size();
+				size_t shortest = base.size(), longest = base.size();
+				std::vector<size_t> members = {bucket[0]};
+				std::vector<size_t> rest;
+
+				for (size_t j = 1; j < bucket.size(); j++) {
+					std::string_view text = shaders.at(*distinct[bucket[j]]);
+					size_t p = common_prefix(base, text, prefix);
+					size_t s = common_suffix(base, text, suffix);
+					size_t minimum = std::min(shortest, text.size());
+					if (p + s > minimum) s = minimum - p;
+
+					if (p + s >= MIN_SHARED_BYTES && 2 * (p + s) >= std::max(longest, text.size())) {
+						prefix = p;
+						suffix = s;
+						shortest = minimum;
+						longest = std::max(longest, text.size());
+						members.push_back(bucket[j]);
+					}
+					else {
+						rest.push_back(bucket[j]);
+					}
+				}
+
+				if (members.size() >= 2) {
+					DeltaGroup group;
+					std::string id = std::to_string(dedup.groups.size());
+					if (prefix > 0) {
+						group.prefix = std::string(1, '\0') + "prefix" + id;
+						texts[group.prefix] = std::string(base.substr(0, prefix));
+					}
+					if (suffix > 0) {
+						group.suffix = std::string(1, '\0') + "suffix" + id;
+						texts[group.suffix] = std::string(base.substr(base.size() - suffix));
+					}
+
+					for (size_t member : members) {
+						const std::string& name = *distinct[member];
+						std::string_view text = shaders.at(name);
+						if (text.size() > prefix + suffix) texts[name] = std::string(text.substr(prefix, text.size() - prefix - suffix));
+						group.members.push_back(name);
+						grouped[member] = true;
+					}
+					dedup.groups.push_back(std::move(group));
+				}
+
+				bucket = std::move(rest);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < distinct.size(); i++) {
+		if (!grouped[i]) texts[*distinct[i]] = shaders.at(*distinct[i]);
+	}
+
+	return texts;
+}
+
+// Function to assemble the compressed shaders from their compressed pieces. The prefixes and suffixes of
+// near-duplicates are added as tokens after the others, as a token may only reference the tokens before it,
+// or copied into each member once the token list is full.
+std::unordered_map<std::string, std::string> assemble_texts(const std::unordered_map<std::string, std::string>& pieces, const ShaderDedup& dedup, Tokens& tokens) {
+	std::unordered_map<std::string, std::string> texts = pieces;
+
+	auto reference = [&](const std::string& key) {
+		if (key.empty()) return std::string();
+
+		std::string piece = std::move(texts.at(key));
+		texts.erase(key);
+		if (tokens.token_list.size() > std::numeric_limits<uint16_t>::max()) return piece;
+
+		size_t index = tokens.token_list.size();
+		tokens.token_list[(uint16_t)index] = std::move(piece);
+		return token_reference(index);
+	};
+
+	for (const DeltaGroup& group : dedup.groups) {
+		std::string prefix = reference(group.prefix);
+		std::string suffix = reference(group.suffix);
+
+		for (const std::string& name : group.members) {
+			std::string& text = texts[name];
+			text = prefix + text + suffix;
+		}
+	}
+
+	return texts;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Token.h"
+
+// Near-duplicate shaders, stored as the prefix and suffix they share around their own middle
+struct DeltaGroup {
+	std::string prefix;               // Key of the shared prefix in the texts to compress, empty if there is none
+	std::string suffix;               // Key of the shared suffix, empty if there is none
+	std::vector<std::string> members; // Shaders of the group, whose middle is compressed under their own name
+};
+
+// Shaders whose content is shared, found before compression
+struct ShaderDedup {
+	std::unordered_map<std::string, std::string> aliases; // Shaders identical to another one, by name, to the one stored
+	std::vector<DeltaGroup> groups;
+};
+
+std::unordered_map<std::string, std::string> dedup_texts(
+	const std::unordered_map<std::string, std::string>& shaders,
+	ShaderDedup& dedup
+);
+
+std::unordered_map<std::string, std::string> assemble_texts(
+	const std::unordered_map<std::string, std::string>& pieces,
+	const ShaderDedup& dedup,
+	Tokens& tokens
+);
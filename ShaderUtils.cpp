@@ -1,148 +1,375 @@
 #include "ShaderUtils.h"
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
-#include <vector>
 #include <unordered_set>
-#include <stack>
+#include <vector>
 
-// Extracts and renames external variables, uniforms, ins and outs, in GLSL code
-std::string extractExternals(
-	std::string code,
-	std::unordered_map<std::string, std::string>& globalUniformMap,
-	std::unordered_map<std::string, std::string>& globalInOutMap,
+// Character classes of the lexer, as the C locale classifies ASCII characters
+enum CharClass : uint8_t {
+	CHAR_OTHER = 0,
+	CHAR_IDENTIFIER = 1, // Letters and '_', which start identifiers
+	CHAR_DIGIT = 2,
+	CHAR_SPACE = 4,
+	CHAR_PUNCT = 8,
+	CHAR_BRACKET = 16,   // Parentheses and braces, which open and close parameter lists and scopes
+};
+
+static constexpr std::array<uint8_t, 256> makeCharClasses() {
+	std::array<uint8_t, 256> classes{};
+	for (int c = 0; c < 128; c++) {
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') classes[c] = CHAR_IDENTIFIER;
+		else if (c >= '0' && c <= '9') classes[c] = CHAR_DIGIT;
+		else if (c == ' ' || (c >= '\t' && c <= '\r')) classes[c] = CHAR_SPACE;
+		else if (c > ' ' && c < 127) classes[c] = CHAR_PUNCT;
+	}
+	for (char c : {'(', ')', '{', '}'}) {
+		classes[(unsigned char)c] |= CHAR_BRACKET;
+	}
+	return classes;
+}
+
+static constexpr std::array<uint8_t, 256> charClasses = makeCharClasses();
+
+static uint8_t charClass(char c) {
+	return charClasses[static_cast<unsigned char>(c)];
+}
+
+// FNV-1a hash of identifiers, computed as they are lexed
+static constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+static constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+static uint64_t hashIdentifier(std::string_view name) {
+	uint64_t hash = FNV_OFFSET;
+	for (char c : name) hash = (hash ^ static_cast<unsigned char>(c)) * FNV_PRIME;
+	return hash;
+}
+
+// Lexes GLSL code, renaming its external variables, uniforms, ins and outs, with the global names given.
+// When collecting, the externals it declares and its identifier occurrences are recorded instead, and nothing is returned.
+// Identifiers are lexed as views over the code and interned, scopes and shadowing being tracked by identifier ID.
+// Unlike the std::ispunct based lexer it replaced, '_' is not punctuation when looking past the spaces after an
+// identifier, so in malformed declarations like "uniform time _q" or "uniform+)if _q pos;" the identifier followed
+// by one starting with '_' is not taken for a declared or replaced name. An identifier ending the code is kept.
+static std::string lexExternals(
+	std::string_view code,
+	const std::unordered_map<std::string, std::string>& globalUniformMap,
+	const std::unordered_map<std::string, std::string>& globalInOutMap,
+	ShaderExternals* collected,
 	bool verbose
 ) {
-	auto replaceGlobal = [&](const std::string& name) -> std::string {
-		if (globalUniformMap.count(name)) return globalUniformMap[name];
-		if (globalInOutMap.count(name)) return globalInOutMap[name];
-		return {};
+	struct Identifier {
+		std::string_view name;
+		uint32_t shadowCount;        // Scopes declaring it
+		const std::string* uniform;  // Global names it is replaced with, uniforms first
+		const std::string* inOut;
+		size_t occurrences;
+		bool declaredUniform;
+		bool declaredInOut;
 	};
 
-	std::vector<std::unordered_set<std::string>> scopeStack;
-	std::vector<std::string> params;
+	// Open addressing table of identifier IDs plus one, by hash of their name, never more than half full
+	std::vector<Identifier> identifiers;
+	std::vector<uint32_t> slots(1024, 0);
+	std::vector<uint64_t> hashes;
+
+	auto intern = [&](std::string_view name, uint64_t hash) -> uint32_t {
+		size_t mask = slots.size() - 1;
+		size_t slot = hash & mask;
+		for (; slots[slot] != 0; slot = (slot + 1) & mask) {
+			uint32_t id = slots[slot] - 1;
+			if (hashes[id] == hash && identifiers[id].name == name) return id;
+		}
+
+		uint32_t id = (uint32_t)identifiers.size();
+		std::string key(name);
+		auto uniform = globalUniformMap.find(key);
+		auto inOut = globalInOutMap.find(key);
+		identifiers.push_back({
+			name, 0,
+			uniform == globalUniformMap.end() ? nullptr : &uniform->second,
+			inOut == globalInOutMap.end() ? nullptr : &inOut->second,
+			0, false, false
+		});
+		hashes.push_back(hash);
+		slots[slot] = id + 1;
 
-	auto isShadowed = [&](const std::string& name) -> bool {
-		for (auto it = scopeStack.rbegin(); it != scopeStack.rend(); ++it)
-			if (it->count(name)) return true;
-		for (const auto& p : params)
-			if (p == name) return true;
-		return false;
+		if (identifiers.size() * 2 > slots.size()) {
+			std::fill(slots.begin(), slots.end(), 0);
+			slots.resize(slots.size() * 2, 0);
+			mask = slots.size() - 1;
+			for (uint32_t i = 0; i < identifiers.size(); i++) {
+				size_t s = hashes[i] & mask;
+				while (slots[s] != 0) s = (s + 1) & mask;
+				slots[s] = i + 1;
+			}
+		}
+		return id;
 	};
 
+	const uint32_t UNIFORM = intern("uniform", hashIdentifier("uniform"));
+	const uint32_t IN = intern("in", hashIdentifier("in"));
+	const uint32_t OUT = intern("out", hashIdentifier("out"));
+	const uint32_t NO_DECLARATION = UINT32_MAX;
+
+	// Names declared by each open scope, stacked, and the parameters of the last parenthesis
+	std::vector<uint32_t> scopedNames;
+	std::vector<size_t> scopeStarts;
+	std::vector<uint32_t> params;
+
+	auto pushScope = [&]() {
+		scopeStarts.push_back(scopedNames.size());
+	};
+	auto declare = [&](uint32_t id) {
+		scopedNames.push_back(id);
+		identifiers[id].shadowCount++;
+	};
+	auto popScope = [&]() {
+		for (size_t i = scopeStarts.back(); i < scopedNames.size(); i++) identifiers[scopedNames[i]].shadowCount--;
+		scopedNames.resize(scopeStarts.back());
+		scopeStarts.pop_back();
+	};
+	auto isShadowed = [&](uint32_t id) -> bool {
+		return identifiers[id].shadowCount > 0 || std::find(params.begin(), params.end(), id) != params.end();
+	};
+
+	// The code is copied as is up to each identifier replaced
 	std::string output;
-	std::string currentToken, declKind;
+	if (!collected) output.reserve(code.size() + code.size() / 8);
+	size_t copied = 0;
+
+	auto write = [&](size_t begin, size_t end, std::string_view name) {
+		if (name.data() == code.data() + begin) return;
+		output.append(code.data() + copied, begin - copied);
+		output.append(name.data(), name.size());
+		copied = end;
+	};
 
+	uint32_t declKind = NO_DECLARATION;
 	int parenDepth = 0;
 	int previousWords = 0;
+	char previousNonSpace = '\0'; // Last character that was neither part of an identifier nor of a number
 
-	char previousNonSpace = '\0';
-
-	size_t i = 0;
-	
-	auto nextNonSpace = [&](char c) -> char {
-		for (size_t j = i; j < code.size(); j++) {
-			if (!std::isspace(static_cast<unsigned char>(code[j]))) {
-				return code[j];
-			}
+	// Effects of a character taking place before the identifier it ends, if any, is processed
+	auto beginChar = [&](char c, bool endsIdentifier) {
+		if (c == '(') {
+			params.clear();
+			parenDepth++;
+		}
+		else if (c == '{') {
+			pushScope();
+			for (uint32_t p : params) declare(p);
+			params.clear();
+		}
+		else if (c == '}') {
+			if (!scopeStarts.empty()) popScope();
+		}
+		else if (endsIdentifier && (charClass(c) & (CHAR_SPACE | CHAR_PUNCT))) {
+			previousWords++;
 		}
-		return c;
 	};
 
-	while (i < code.size()) {
-		char c = code[i];
+	// Effects of a character taking place after the identifier it ends, if any, is processed
+	auto endChar = [&](char c) {
+		if (c == ')' && parenDepth > 0) parenDepth--;
+		if (charClass(c) & CHAR_PUNCT) previousWords = 0;
+		previousNonSpace = c;
+	};
 
-		// --- IDENTIFIERS ---
-		if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
-			currentToken += c;
+	// Returns what an identifier is written as, given the character ending it and the first non-space one from there
+	auto processIdentifier = [&](uint32_t id, char end, char nextChar) -> std::string_view {
+		std::string_view name = identifiers[id].name;
+
+		if (parenDepth == 0 && (id == UNIFORM || id == IN || id == OUT)) {
+			declKind = id;
+			return name;
 		}
-		else if (std::isdigit(static_cast<unsigned char>(c))) {
-			if (!currentToken.empty()) currentToken += c;
-			else output += c;
+		if (!(charClass(nextChar) & CHAR_PUNCT)) return name;
+
+		if (parenDepth > 0 && previousWords > 1) {
+			params.push_back(id);
 		}
-		else {
-			// --- PARENTHESES ---
-			if (c == '(') {
-				params.clear();
-				parenDepth++;
+		else if (parenDepth == 0 && declKind != NO_DECLARATION) {
+			bool uniform = declKind == UNIFORM;
+			if (collected) {
+				bool& declared = uniform ? identifiers[id].declaredUniform : identifiers[id].declaredInOut;
+				if (!declared) (uniform ? collected->uniforms : collected->inOuts).emplace_back(name);
+				declared = true;
 			}
-			// --- SCOPES ---
-			else if (c == '{') {
-				scopeStack.emplace_back();
-				if (!params.empty()) {
-					for (const auto& p : params) scopeStack.back().insert(p);
-					params.clear();
-				}
+			else if (const std::string* global = uniform ? identifiers[id].uniform : identifiers[id].inOut) {
+				name = *global;
 			}
-			else if (c == '}') {
-				if (!scopeStack.empty()) scopeStack.pop_back();
+		}
+		else if (previousNonSpace != '.' && !isShadowed(id)) {
+			if (previousWords > 1) {
+				if (scopeStarts.empty()) pushScope();
+				declare(id);
 			}
-			// --- WHITESPACE AND PUNCTUATION ---
-			else if (std::isspace(static_cast<unsigned char>(c)) || std::ispunct(static_cast<unsigned char>(c))) {
-				if (i >= 1 && !std::isspace(static_cast<unsigned char>(code[i - 1])) && !currentToken.empty()) {
-					previousWords++;
+			else if (!collected) {
+				const std::string* replacement = identifiers[id].uniform ? identifiers[id].uniform : identifiers[id].inOut;
+				if (replacement) {
+					if (verbose) printf("Replacing %.*s with %s\n", (int)name.size(), name.data(), replacement->c_str());
+					name = *replacement;
 				}
 			}
+		}
+
+		if (end == ';') {
+			declKind = NO_DECLARATION;
+			if (parenDepth > 0 && !params.empty()) params.clear();
+		}
+		return name;
+	};
 
-			// --- END OF TOKEN ---
-			if (!currentToken.empty()) {
-				char nextChar = nextNonSpace(c);
+	size_t i = 0;
+	const size_t size = code.size();
+	while (i < size) {
+		uint8_t type = charClass(code[i]);
 
-				if (parenDepth == 0 && (currentToken == "uniform" || currentToken == "in" || currentToken == "out")) {
-					declKind = currentToken;
-				}
-				else if (std::ispunct(static_cast<unsigned char>(nextChar))) {
-					if (parenDepth > 0 && previousWords > 1) {
-						params.push_back(currentToken);
-					}
-					else if (parenDepth == 0 && !declKind.empty()) {
-						auto& map = (declKind == "uniform" ? globalUniformMap : globalInOutMap);
-						auto it = map.find(currentToken);
-						if (it == map.end()) map[currentToken] = (declKind == "uniform" ? "u" : "a") + std::to_string(map.size());
-
-						if (verbose) std::cout << "Found " << declKind << ": " << currentToken << " -> " << map[currentToken] << "\n";
-
-						currentToken = map[currentToken];
-					}
-					else if (previousNonSpace != '.' && !isShadowed(currentToken)) {
-						if (previousWords > 1) {
-							if (scopeStack.empty()) scopeStack.emplace_back();
-							scopeStack.back().insert(currentToken);
-						}
-						else {
-							std::string replacement = replaceGlobal(currentToken);
-							if (!replacement.empty()) {
-								printf("Replacing %s with %s\n", currentToken.c_str(), replacement.c_str());
-								currentToken = replacement;
-							}
-						}
-					}
-
-					if (c == ';') {
-						declKind.clear();
-						if (parenDepth > 0 && !params.empty()) params.clear();
-					}
-				}
+		// --- IDENTIFIERS ---
+		if (type & CHAR_IDENTIFIER) {
+			uint64_t hash = (FNV_OFFSET ^ static_cast<unsigned char>(code[i])) * FNV_PRIME;
+			size_t end = i + 1;
+			while (end < size && (charClass(code[end]) & (CHAR_IDENTIFIER | CHAR_DIGIT))) {
+				hash = (hash ^ static_cast<unsigned char>(code[end++])) * FNV_PRIME;
+			}
+			uint32_t id = intern(code.substr(i, end - i), hash);
+			identifiers[id].occurrences++;
 
-				output += currentToken;
-				currentToken.clear();
+			if (end == size) {
+				write(i, end, processIdentifier(id, '\0', '\0'));
+				break;
 			}
 
-			if (c == ')') {
-				if (parenDepth > 0) parenDepth--;
+			// Spaces right after the identifier are skipped along with it
+			size_t next = end;
+			while (next < size && (charClass(code[next]) & CHAR_SPACE)) next++;
+
+			char c = code[end];
+			beginChar(c, true);
+			write(i, end, processIdentifier(id, c, next < size ? code[next] : c));
+			endChar(c);
+
+			if (next > end + 1) {
+				previousNonSpace = code[next - 1];
+				i = next;
+			}
+			else {
+				i = end + 1;
 			}
+		}
+		// --- SCOPES AND PARENTHESES ---
+		else if (type & CHAR_BRACKET) {
+			beginChar(code[i], false);
+			endChar(code[i]);
+			i++;
+		}
+		// --- NUMBERS, WHITESPACE AND OTHER PUNCTUATION ---
+		else {
+			size_t end = i;
+			uint8_t seen = 0;
+			while (end < size && !(charClass(code[end]) & (CHAR_IDENTIFIER | CHAR_BRACKET))) seen |= charClass(code[end++]);
 
-			if (std::ispunct(static_cast<unsigned char>(c))) previousWords = 0;
+			if (seen & CHAR_PUNCT) previousWords = 0;
+			for (size_t last = end; last > i; last--) {
+				if (!(charClass(code[last - 1]) & CHAR_DIGIT)) {
+					previousNonSpace = code[last - 1];
+					break;
+				}
+			}
+			i = end;
+		}
+	}
 
-			output += c;
-			previousNonSpace = c;
+	if (collected) {
+		for (const Identifier& identifier : identifiers) {
+			if (identifier.occurrences > 0) collected->occurrences[std::string(identifier.name)] = identifier.occurrences;
 		}
-		
-		i++;
+		return {};
 	}
 
+	output.append(code.data() + copied, size - copied);
 	return output;
 }
 
+// Collects the external variables a shader declares, and how often each identifier occurs in it
+ShaderExternals collectExternals(std::string_view code) {
+	static const std::unordered_map<std::string, std::string> noNames;
+
+	ShaderExternals externals;
+	lexExternals(code, noNames, noNames, &externals, false);
+	return externals;
+}
+
+// Gives a global name to every external the maps miss, with the lowest numbers their names do not use, so that the names
+// they have are kept. Uniforms are named u<n> and ins and outs a<n>, the ones occurring most in the shaders getting the
+// lowest numbers, then by name.
+void assignExternalNames(
+	const std::vector<const ShaderExternals*>& shaders,
+	std::unordered_map<std::string, std::string>& globalUniformMap,
+	std::unordered_map<std::string, std::string>& globalInOutMap,
+	bool verbose
+) {
+	auto assign = [&](std::vector<std::string> ShaderExternals::* declared, std::unordered_map<std::string, std::string>& map, const char* prefix, const char* kind) {
+		std::unordered_map<std::string, size_t> frequencies;
+		for (const ShaderExternals* shader : shaders) {
+			for (const std::string& name : shader->*declared) {
+				if (!map.count(name)) frequencies[name] = 0;
+			}
+		}
+		for (const ShaderExternals* shader : shaders) {
+			for (auto& [name, frequency] : frequencies) {
+				auto it = shader->occurrences.find(name);
+				if (it != shader->occurrences.end()) frequency += it->second;
+			}
+		}
+
+		std::vector<std::pair<std::string, size_t>> ordered(frequencies.begin(), frequencies.end());
+		std::sort(ordered.begin(), ordered.end(), [](const auto& a, const auto& b) {
+			return a.second != b.second ? a.second > b.second : a.first < b.first;
+		});
+
+		std::unordered_set<std::string> used;
+		for (const auto& [name, global] : map) used.insert(global);
+
+		size_t number = 0;
+		for (const auto& [name, frequency] : ordered) {
+			while (used.count(prefix + std::to_string(number))) number++;
+			std::string global = prefix + std::to_string(number++);
+			if (verbose) std::cout << "Found " << kind << ": " << name << " -> " << global << " (" << frequency << " occurrences)\n";
+			map.emplace(name, std::move(global));
+		}
+	};
+
+	assign(&ShaderExternals::uniforms, globalUniformMap, "u", "uniform");
+	assign(&ShaderExternals::inOuts, globalInOutMap, "a", "in/out");
+}
+
+// Renames the external variables of GLSL code with their global names
+std::string renameExternals(
+	std::string_view code,
+	const std::unordered_map<std::string, std::string>& globalUniformMap,
+	const std::unordered_map<std::string, std::string>& globalInOutMap,
+	bool verbose
+) {
+	return lexExternals(code, globalUniformMap, globalInOutMap, nullptr, verbose);
+}
+
+// Extracts and renames external variables, uniforms, ins and outs, in GLSL code, naming the ones the maps miss
+std::string extractExternals(
+	std::string_view code,
+	std::unordered_map<std::string, std::string>& globalUniformMap,
+	std::unordered_map<std::string, std::string>& globalInOutMap,
+	bool verbose
+) {
+	ShaderExternals externals = collectExternals(code);
+	assignExternalNames({&externals}, globalUniformMap, globalInOutMap, verbose);
+	return renameExternals(code, globalUniformMap, globalInOutMap, verbose);
+}
+
 // Retrieves the GLSL version directive position from shader code
 int extractGLSLVersion(const std::string& code) {
 	size_t pos = code.find("#version");
@@ -1,10 +1,35 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
+
+// External variables a shader declares, in declaration order, and how often each identifier occurs in it
+struct ShaderExternals {
+	std::vector<std::string> uniforms;
+	std::vector<std::string> inOuts;
+	std::unordered_map<std::string, size_t> occurrences;
+};
+
+ShaderExternals collectExternals(std::string_view code);
+
+void assignExternalNames(
+	const std::vector<const ShaderExternals*>& shaders,
+	std::unordered_map<std::string, std::string>& globalUniformMap,
+	std::unordered_map<std::string, std::string>& globalInOutMap,
+	bool verbose
+);
+
+std::string renameExternals(
+	std::string_view code,
+	const std::unordered_map<std::string, std::string>& globalUniformMap,
+	const std::unordered_map<std::string, std::string>& globalInOutMap,
+	bool verbose
+);
 
 std::string extractExternals(
-	std::string code,
+	std::string_view code,
 	std::unordered_map<std::string, std::string>& globalUniformMap,
 	std::unordered_map<std::string, std::string>& globalInOutMap,
 	bool verbose
@@ -0,0 +1,95 @@
+#include "Stats.h"
+
+#include <cstdio>
+#include <sstream>
+
+std::atomic<uint64_t> allocation_count{0};
+
+PhaseTimer::PhaseTimer(std::vector<PhaseStats>& phases, std::string name)
+	: phases(&phases), name(std::move(name)), start(std::chrono::steady_clock::now()), start_allocations(allocation_count.load(std::memory_order_relaxed)) {
+}
+
+void PhaseTimer::stop() {
+	if (!phases) return;
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	add_phase(*phases, {name, elapsed.count(), allocation_count.load(std::memory_order_relaxed) - start_allocations});
+	phases = nullptr;
+}
+
+void add_phase(std::vector<PhaseStats>& phases, const PhaseStats& phase) {
+	for (PhaseStats& existing : phases) {
+		if (existing.name == phase.name) {
+			existing.seconds += phase.seconds;
+			existing.allocations += phase.allocations;
+			return;
+		}
+	}
+	phases.push_back(phase);
+}
+
+// Function to escape a string for a JSON string literal
+static std::string escapeJSON(const std::string& text) {
+	std::string escaped;
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			escaped += '\\';
+			escaped += c;
+		}
+		else if ((unsigned char)c < 0x20) {
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+			escaped += code;
+		}
+		else {
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+// Function to generate the stats report of a job, one JSON object
+std::string generateStatsJSON(const JobStats& stats) {
+	std::ostringstream json;
+
+	size_t sourceSize = 0, compressedSize = 0;
+	for (const ShaderStats& shader : stats.shaders) {
+		sourceSize += shader.source_size;
+		compressedSize += shader.compressed_size;
+	}
+
+	json << "{" << std::endl;
+	json << "\t\"source_size\": " << sourceSize << "," << std::endl;
+	json << "\t\"compressed_size\": " << compressedSize << "," << std::endl;
+	json << "\t\"dictionary_size\": " << stats.dictionary_size << "," << std::endl;
+	json << "\t\"pack_size\": " << stats.pack_size << "," << std::endl;
+
+	json << "\t\"phases\": [";
+	for (size_t i = 0; i < stats.phases.size(); i++) {
+		const PhaseStats& phase = stats.phases[i];
+		json << (i ? "," : "") << std::endl << "\t\t{\"name\": \"" << escapeJSON(phase.name) << "\", \"seconds\": " << phase.seconds
+			<< ", \"allocations\": " << phase.allocations << "}";
+	}
+	json << std::endl << "\t]," << std::endl;
+
+	json << "\t\"tokens\": [";
+	for (size_t i = 0; i < stats.tokens.size(); i++) {
+		const TokenSearchStats& token = stats.tokens[i];
+		json << (i ? "," : "") << std::endl << "\t\t{\"length\": " << token.length << ", \"score\": " << token.score
+			<< ", \"count\": " << token.count << ", \"single_char\": " << (token.single_char ? "true" : "false")
+			<< ", \"seconds\": " << token.seconds << ", \"allocations\": " << token.allocations << "}";
+	}
+	json << std::endl << "\t]," << std::endl;
+
+	json << "\t\"shaders\": [";
+	for (size_t i = 0; i < stats.shaders.size(); i++) {
+		const ShaderStats& shader = stats.shaders[i];
+		json << (i ? "," : "") << std::endl << "\t\t{\"name\": \"" << escapeJSON(shader.name) << "\", \"source_size\": " << shader.source_size
+			<< ", \"compressed_size\": " << shader.compressed_size << ", \"ratio\": "
+			<< (shader.source_size ? (double)shader.compressed_size / shader.source_size : 0.0) << "}";
+	}
+	json << std::endl << "\t]" << std::endl;
+	json << "}" << std::endl;
+
+	return json.str();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Allocations made by the whole process so far. Only counted by executables replacing operator new to increment it,
+// it stays 0 otherwise.
+extern std::atomic<uint64_t> allocation_count;
+
+// Wall time and allocations of a phase of a compression job, summed over every time it ran
+struct PhaseStats {
+	std::string name;
+	double seconds = 0;
+	uint64_t allocations = 0;
+};
+
+// Token found by an iteration of the search, with what finding it cost
+struct TokenSearchStats {
+	size_t length;
+	int score;
+	int count;
+	bool single_char;
+	double seconds;
+	uint64_t allocations;
+};
+
+// Size of a shader before processing and once compressed, the shared dictionary excluded
+struct ShaderStats {
+	std::string name;
+	size_t source_size;
+	size_t compressed_size;
+};
+
+struct JobStats {
+	std::vector<PhaseStats> phases;
+	std::vector<TokenSearchStats> tokens;
+	std::vector<ShaderStats> shaders;
+	size_t dictionary_size = 0; // Tokens with their storage cost
+	size_t pack_size = 0;
+};
+
+// Measures a phase from its construction until stop() or its destruction, then adds it to the phases
+class PhaseTimer {
+public:
+	PhaseTimer(std::vector<PhaseStats>& phases, std::string name);
+	~PhaseTimer() { stop(); }
+
+	PhaseTimer(const PhaseTimer&) = delete;
+	PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+	void stop();
+
+private:
+	std::vector<PhaseStats>* phases;
+	std::string name;
+	std::chrono::steady_clock::time_point start;
+	uint64_t start_allocations;
+};
+
+// Adds a phase to a list, summing it with the phase of the same name if there is one
+void add_phase(std::vector<PhaseStats>& phases, const PhaseStats& phase);
+
+std::string generateStatsJSON(const JobStats& stats);
@@ -0,0 +1,341 @@
+#include "SuffixArray.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Builds the suffix array of s, whose symbols are in [0, upper], using induced sorting (SA-IS)
+static std::vector<int32_t> sa_is(const std::vector<int32_t>& s, int32_t upper) {
+	int32_t n = (int32_t)s.size();
+	if (n == 0) return {};
+	if (n == 1) return {0};
+	if (n == 2) return s[0] < s[1] ? std::vector<int32_t>{0, 1} : std::vector<int32_t>{1, 0};
+
+	std::vector<int32_t> sa(n);
+	std::vector<bool> ls(n, false);
+	for (int32_t i = n - 2; i >= 0; i--) {
+		ls[i] = (s[i] == s[i + 1]) ? ls[i + 1] : (s[i] < s[i + 1]);
+	}
+
+	std::vector<int32_t> sum_l(upper + 1, 0), sum_s(upper + 1, 0);
+	for (int32_t i = 0; i < n; i++) {
+		if (!ls[i]) sum_s[s[i]]++;
+		else sum_l[s[i] + 1]++;
+	}
+	for (int32_t i = 0; i <= upper; i++) {
+		sum_s[i] += sum_l[i];
+		if (i < upper) sum_l[i + 1] += sum_s[i];
+	}
+
+	auto induce = [&](const std::vector<int32_t>& lms) {
+		std::fill(sa.begin(), sa.end(), -1);
+		std::vector<int32_t> buf(sum_s);
+		for (int32_t d : lms) {
+			if (d == n) continue;
+			sa[buf[s[d]]++] = d;
+		}
+
+		buf = sum_l;
+		sa[buf[s[n - 1]]++] = n - 1;
+		for (int32_t i = 0; i < n; i++) {
+			int32_t v = sa[i];
+			if (v >= 1 && !ls[v - 1]) sa[buf[s[v - 1]]++] = v - 1;
+		}
+
+		buf = sum_l;
+		for (int32_t i = n - 1; i >= 0; i--) {
+			int32_t v = sa[i];
+			if (v >= 1 && ls[v - 1]) sa[--buf[s[v - 1] + 1]] = v - 1;
+		}
+	};
+
+	std::vector<int32_t> lms_map(n + 1, -1);
+	std::vector<int32_t> lms;
+	for (int32_t i = 1; i < n; i++) {
+		if (!ls[i - 1] && ls[i]) {
+			lms_map[i] = (int32_t)lms.size();
+			lms.push_back(i);
+		}
+	}
+	int32_t m = (int32_t)lms.size();
+
+	induce(lms);
+
+	if (m) {
+		std::vector<int32_t> sorted_lms;
+		sorted_lms.reserve(m);
+		for (int32_t v : sa) {
+			if (lms_map[v] != -1) sorted_lms.push_back(v);
+		}
+
+		// Name the LMS substrings, equal substrings share a name
+		std::vector<int32_t> rec_s(m);
+		int32_t rec_upper = 0;
+		rec_s[lms_map[sorted_lms[0]]] = 0;
+		for (int32_t i = 1; i < m; i++) {
+			int32_t l = sorted_lms[i - 1], r = sorted_lms[i];
+			int32_t end_l = (lms_map[l] + 1 < m) ? lms[lms_map[l] + 1] : n;
+			int32_t end_r = (lms_map[r] + 1 < m) ? lms[lms_map[r] + 1] : n;
+			bool same = true;
+			if (end_l - l != end_r - r) {
+				same = false;
+			}
+			else {
+				while (l < end_l && s[l] == s[r]) {
+					l++;
+					r++;
+				}
+				if (l == n || s[l] != s[r]) same = false;
+			}
+			if (!same) rec_upper++;
+			rec_s[lms_map[sorted_lms[i]]] = rec_upper;
+		}
+
+		std::vector<int32_t> rec_sa = sa_is(rec_s, rec_upper);
+		for (int32_t i = 0; i < m; i++) {
+			sorted_lms[i] = lms[rec_sa[i]];
+		}
+		induce(sorted_lms);
+	}
+
+	return sa;
+}
+
+// Computes the LCP array from the suffix array (Kasai et al.), split in independent ranges of text positions
+static std::vector<int32_t> lcp_array(const std::vector<int32_t>& s, const std::vector<int32_t>& sa, ThreadPool& pool) {
+	int32_t n = (int32_t)s.size();
+	if (n < 2) return {};
+
+	std::vector<int32_t> rank(n);
+	for (int32_t i = 0; i < n; i++) rank[sa[i]] = i;
+
+	std::vector<int32_t> lcp(n - 1);
+	size_t parts = pool.size();
+	pool.run(parts, [&](size_t part) {
+		int32_t begin = (int32_t)((size_t)n * part / parts);
+		int32_t end = (int32_t)((size_t)n * (part + 1) / parts);
+
+		int32_t h = 0;
+		for (int32_t i = begin; i < end; i++) {
+			if (h > 0) h--;
+			if (rank[i] == 0) continue;
+			int32_t j = sa[rank[i] - 1];
+			while (j + h < n && i + h < n && s[j + h] == s[i + h]) h++;
+			lcp[rank[i] - 1] = h;
+		}
+	});
+
+	return lcp;
+}
+
+// Function to get the mask of the '$' bytes among 64 bytes, bit i for byte i
+static uint64_t dollar_mask(const char* bytes) {
+#if defined(__AVX2__)
+	const __m256i dollar = _mm256_set1_epi8('$');
+	uint32_t low = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)bytes), dollar));
+	uint32_t high = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(bytes + 32)), dollar));
+	return low | ((uint64_t)high << 32);
+#elif defined(__ARM_NEON)
+	// Each matching byte keeps its bit within its group of 8, pairwise additions then gather the groups
+	static const uint8_t BIT_VALUES[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	const uint8x16_t bits = vld1q_u8(BIT_VALUES);
+	const uint8x16_t dollar = vdupq_n_u8('$');
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(bytes);
+	uint8x16_t m0 = vandq_u8(vceqq_u8(vld1q_u8(data), dollar), bits);
+	uint8x16_t m1 = vandq_u8(vceqq_u8(vld1q_u8(data + 16), dollar), bits);
+	uint8x16_t m2 = vandq_u8(vceqq_u8(vld1q_u8(data + 32), dollar), bits);
+	uint8x16_t m3 = vandq_u8(vceqq_u8(vld1q_u8(data + 48), dollar), bits);
+	uint8x16_t sum = vpaddq_u8(vpaddq_u8(m0, m1), vpaddq_u8(m2, m3));
+	sum = vpaddq_u8(sum, sum);
+	return vgetq_lane_u64(vreinterpretq_u64_u8(sum), 0);
+#else
+	// Bytes equal to '$' are the zero bytes of each word xored with '$', whose high bits are gathered by a multiplication
+	constexpr uint64_t DOLLARS = 0x2424242424242424ull;
+	constexpr uint64_t LOW_BITS = 0x7F7F7F7F7F7F7F7Full;
+	uint64_t mask = 0;
+	for (int i = 0; i < 8; i++) {
+		uint64_t word;
+		std::memcpy(&word, bytes + i * 8, sizeof(word));
+		word ^= DOLLARS;
+		uint64_t zeros = ~(((word & LOW_BITS) + LOW_BITS) | word) & ~LOW_BITS;
+		mask |= (((zeros >> 7) * 0x0102040810204080ull) >> 56) << (i * 8);
+	}
+	return mask;
+#endif
+}
+
+// Function to set bits of a bit vector from a 64-bit value, starting at any bit
+static void or_bits(std::vector<uint64_t>& bits, size_t offset, uint64_t value) {
+	size_t shift = offset & 63;
+	bits[offset >> 6] |= value << shift;
+	if (shift > 0) bits[(offset >> 6) + 1] |= value >> (64 - shift);
+}
+
+// Function to mark where tokens may not start or end, 64 positions at a time. A position is inside a '$' escape when
+// one of the two bytes of its text before it is a '$', which is looked at for a whole block at once.
+static void mark_boundaries(SuffixArray& index, const std::vector<std::string_view>& texts) {
+	size_t words = index.symbols.size() / 64 + 2;
+	index.no_start.assign(words, 0);
+	index.no_end.assign(words, 0);
+
+	char block[64];
+	size_t start = 0;
+	for (const auto& text : texts) {
+		// Positions of the text and of its separator, a token may end right before it
+		size_t positions = text.size() + 1;
+		uint64_t previous = 0;
+		for (size_t i = 0; i < positions; i += 64) {
+			const char* bytes = text.data() + i;
+			if (i + 64 > text.size()) {
+				std::memset(block, 0, sizeof(block));
+				if (i < text.size()) std::memcpy(block, bytes, text.size() - i);
+				bytes = block;
+			}
+
+			uint64_t dollars = dollar_mask(bytes);
+			uint64_t escapes = (dollars << 1) | (dollars << 2) | (previous >> 63) | (previous >> 62);
+			if (positions - i < 64) escapes &= (1ull << (positions - i)) - 1;
+			previous = dollars;
+
+			or_bits(index.no_end, start + i, escapes);
+			or_bits(index.no_start, start + i, escapes);
+		}
+
+		or_bits(index.no_start, start + text.size(), 1);
+		start += positions;
+	}
+}
+
+// Function to build the generalized suffix array and LCP array of a set of texts
+SuffixArray build_suffix_array(const std::vector<std::string_view>& texts, ThreadPool& pool) {
+	SuffixArray index;
+
+	size_t total = 0;
+	for (const auto& text : texts) total += text.size() + 1;
+	if (total > (size_t)std::numeric_limits<int32_t>::max()) {
+		throw std::runtime_error("Error: Input too large to be indexed (" + std::to_string(total) + " bytes).");
+	}
+
+	// Every text gets a unique separator so that no repeat can span two texts
+	index.symbols.reserve(total);
+	int32_t separator = 256;
+	for (const auto& text : texts) {
+		for (char c : text) index.symbols.push_back(static_cast<uint8_t>(c));
+		index.symbols.push_back(separator++);
+	}
+
+	index.suffixes = sa_is(index.symbols, separator - 1);
+	index.lcp = lcp_array(index.symbols, index.suffixes, pool);
+	mark_boundaries(index, texts);
+
+	return index;
+}
+
+// Function to split the suffix array in about the given number of ranges that no repeat of minLength or more spans
+std::vector<std::pair<size_t, size_t>> repeat_ranges(const SuffixArray& index, size_t minLength, size_t parts) {
+	std::vector<std::pair<size_t, size_t>> ranges;
+	const size_t n = index.suffixes.size();
+	if (minLength == 0) minLength = 1;
+	if (parts == 0) parts = 1;
+
+	size_t begin = 0;
+	while (begin < n) {
+		size_t end = std::min(n, begin + std::max<size_t>(1, n / parts));
+		while (end < n && (size_t)index.lcp[end - 1] >= minLength) end++;
+		ranges.push_back({begin, end});
+		begin = end;
+	}
+
+	return ranges;
+}
+
+// Function to enumerate the repeated substrings that can be used as tokens, within a range of the suffix array
+// A token may not start inside a '$' escape (one or two bytes after a '$'),
+// and may not end with a '$' or with a '$' followed by a single byte.
+void for_each_repeat(
+	const SuffixArray& index,
+	size_t minLength,
+	size_t maxLength,
+	std::pair<size_t, size_t> range,
+	const std::function<void(const Repeat&)>& callback
+) {
+	const size_t cap = maxLength > 0 ? maxLength : std::numeric_limits<size_t>::max();
+	if (minLength == 0) minLength = 1;
+
+	// Boundaries are looked up in the bit vectors, much smaller than the symbols the suffixes point into at random
+	auto isValidStart = [&](size_t p) -> bool {
+		return may_start(index, p);
+	};
+
+	auto isValidEnd = [&](size_t p, size_t length) -> bool {
+		return may_end(index, p + length);
+	};
+
+	struct Interval {
+		size_t lcp;
+		size_t lb;
+		size_t position;
+		size_t rank;
+	};
+
+	auto report = [&](const Interval& interval, size_t rb, size_t parentLcp) {
+		size_t lo = std::max(parentLcp + 1, minLength);
+		size_t hi = interval.lcp;
+		while (hi >= lo && !isValidEnd(interval.position, hi)) hi--;
+		if (hi < lo) return;
+		while (!isValidEnd(interval.position, lo)) lo++;
+
+		callback({interval.position, hi, lo, rb - interval.lb + 1, interval.rank});
+	};
+
+	// Bottom-up traversal of the LCP intervals over the suffixes that are valid token starts.
+	// The LCP of two consecutive valid suffixes is the minimum over the skipped ones.
+	std::vector<Interval> stack = {{0, 0, 0, 0}};
+	size_t kept = 0, lastPosition = 0, lastRank = 0, running = 0;
+
+	auto processBoundary = [&](size_t h, size_t k) {
+		Interval current = {h, k - 1, lastPosition, lastRank};
+		while (h < stack.back().lcp) {
+			Interval top = stack.back();
+			stack.pop_back();
+			report(top, k - 1, std::max(h, stack.back().lcp));
+			current.lb = top.lb;
+			current.position = top.position;
+			current.rank = top.rank;
+		}
+		if (h > stack.back().lcp) stack.push_back(current);
+	};
+
+	for (size_t i = range.first; i < range.second; i++) {
+		size_t p = (size_t)index.suffixes[i];
+		if (!isValidStart(p)) {
+			if (i + 1 < range.second) running = std::min(running, (size_t)index.lcp[i]);
+			continue;
+		}
+
+		if (kept > 0) processBoundary(std::min(running, cap), kept);
+
+		lastPosition = p;
+		lastRank = i;
+		kept++;
+		running = (i + 1 < range.second) ? (size_t)index.lcp[i] : 0;
+	}
+
+	if (kept > 0) processBoundary(0, kept);
+}
+
+// Function to materialize a repeated substring
+std::string repeat_string(const SuffixArray& index, const Repeat& repeat) {
+	std::string result(repeat.length, '\0');
+	for (size_t i = 0; i < repeat.length; i++) {
+		result[i] = static_cast<char>(index.symbols[repeat.position + i]);
+	}
+	return result;
+}
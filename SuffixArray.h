@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Generalized suffix array over a set of texts, each text being followed by its own separator
+struct SuffixArray {
+	std::vector<int32_t> symbols;  // Concatenated texts, bytes are 0-255 and separators 256 and above
+	std::vector<int32_t> suffixes; // Suffix start positions in lexicographic order
+	std::vector<int32_t> lcp;      // lcp[i] is the longest common prefix of suffixes[i] and suffixes[i + 1]
+	std::vector<uint64_t> no_start; // Bit set at each position a token may not start at: separators and inside '$' escapes
+	std::vector<uint64_t> no_end;   // Bit set at each position a token may not end right before: inside '$' escapes
+};
+
+// Whether a token may start at a position of the concatenated texts
+inline bool may_start(const SuffixArray& index, size_t position) {
+	return !((index.no_start[position >> 6] >> (position & 63)) & 1);
+}
+
+// Whether a token may end right before a position of the concatenated texts
+inline bool may_end(const SuffixArray& index, size_t position) {
+	return !((index.no_end[position >> 6] >> (position & 63)) & 1);
+}
+
+// A substring occurring more than once, described by one of its occurrences
+struct Repeat {
+	size_t position;   // Start of one occurrence in the concatenated texts
+	size_t length;     // Longest valid length sharing this set of occurrences
+	size_t min_length; // Shortest length sharing this set of occurrences
+	size_t count;      // Number of occurrences, overlapping ones included
+	size_t rank;       // Suffix array index of the first occurrence, orders repeats of equal length lexicographically
+};
+
+SuffixArray build_suffix_array(const std::vector<std::string_view>& texts, ThreadPool& pool);
+
+std::vector<std::pair<size_t, size_t>> repeat_ranges(const SuffixArray& index, size_t minLength, size_t parts);
+
+void for_each_repeat(
+	const SuffixArray& index,
+	size_t minLength,
+	size_t maxLength,
+	std::pair<size_t, size_t> range,
+	const std::function<void(const Repeat&)>& callback
+);
+
+std::string repeat_string(const SuffixArray& index, const Repeat& repeat);
@@ -0,0 +1,95 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads) {
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (size_t i = 1; i < threads; i++) {
+		workers.emplace_back([this] { work(); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (std::thread& worker : workers) worker.join();
+}
+
+size_t ThreadPool::size() const {
+	return workers.size() + 1;
+}
+
+// Function run by every worker, it takes part in each job published by run
+void ThreadPool::work() {
+	size_t seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stopping || job != seen; });
+			if (stopping) return;
+			seen = job;
+			active++;
+		}
+
+		drain();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			active--;
+		}
+		done.notify_all();
+	}
+}
+
+// Function to run tasks of the current job until none are left
+void ThreadPool::drain() {
+	size_t i;
+	while ((i = next.fetch_add(1)) < count) {
+		try {
+			(*task)(i);
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!error) error = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (++finished == count) done.notify_all();
+	}
+}
+
+void ThreadPool::run(size_t taskCount, const std::function<void(size_t)>& function) {
+	if (workers.empty() || taskCount <= 1) {
+		for (size_t i = 0; i < taskCount; i++) function(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		task = &function;
+		count = taskCount;
+		next = 0;
+		finished = 0;
+		error = nullptr;
+		job++;
+	}
+	wake.notify_all();
+
+	drain();
+
+	// Workers must be out of drain before the next job resets the counters
+	std::exception_ptr failure;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [&] { return finished == count && active == 0; });
+		failure = error;
+		task = nullptr;
+		count = 0;
+	}
+
+	if (failure) std::rethrow_exception(failure);
+}
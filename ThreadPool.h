@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running indexed tasks, the calling thread takes part in the work
+class ThreadPool {
+public:
+	// A thread count of 0 uses every hardware thread
+	explicit ThreadPool(size_t threads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t size() const;
+
+	// Runs task(i) for every i in [0, count) and waits for all of them to complete
+	void run(size_t count, const std::function<void(size_t)>& task);
+
+private:
+	void work();
+	void drain();
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	const std::function<void(size_t)>* task = nullptr;
+	size_t count = 0;
+	std::atomic<size_t> next{0};
+	size_t finished = 0;
+	size_t active = 0;
+	size_t job = 0;
+	bool stopping = false;
+	std::exception_ptr error;
+};
@@ -1,92 +1,288 @@
 #include "Token.h"
+#include "SuffixArray.h"
+#include "OccurrenceIndex.h"
+#include "ThreadPool.h"
 
 #include <iostream>
 #include <vector>
 #include <string>
 #include <algorithm>
-#include <sstream>
+#include <chrono>
+#include <cstring>
+#include <functional>
 #include <limits>
+#include <stdexcept>
+
+// Replacements looked ahead by the beam search before choosing a token, the first one included
+static constexpr size_t LOOKAHEAD_STEPS = 8;
+
+// Whether a repeat makes a better token than another with the same score: longer, then lexicographically smaller
+static bool preferred(const Repeat& a, const Repeat& b) {
+	if (a.length != b.length) return a.length > b.length;
+	return a.rank < b.rank;
+}
 
 // Function to find the best token based on occurrences and scoring
-TokenInfo find_best_token(const std::unordered_map<std::string, std::string>& texts, bool find_large, size_t minTokenSize, size_t maxTokenSize, bool verbose) {
-	std::unordered_map<std::string, int> occurrences;
+TokenInfo find_best_token(const std::unordered_map<std::string, std::string>& texts, bool find_large, size_t minTokenSize, size_t maxTokenSize, ThreadPool& pool) {
+	std::vector<std::string_view> views;
+	views.reserve(texts.size());
+	for (const auto& [name, text] : texts) views.push_back(text);
 
-	for (const auto& [name, text] : texts) {
-		size_t text_length = text.size();
+	SuffixArray index = build_suffix_array(views, pool);
 
-		// Limit the length of the text to maxTokenSize
-		if (maxTokenSize > 0 && text_length > maxTokenSize) text_length = maxTokenSize;
+	int long_rep = find_large ? 3 : 1;
 
-		// Count occurrences of substrings
-		if (text_length >= minTokenSize) {
-			for (size_t len = minTokenSize; len <= text_length; len++) {
-				for (int i = 0; i <= text_length - len; i++) {
-					// Cutting just after a '$'
-					if ((i > 0 && text[i - 1] == '$') || (i > 1 && text[i - 2] == '$')) continue;
+	// Every range of the suffix array keeps its own best repeat, the ranges are then reduced in order
+	std::vector<std::pair<size_t, size_t>> ranges = repeat_ranges(index, minTokenSize, pool.size() * 4);
+	std::vector<std::pair<int, Repeat>> shards(ranges.size(), {-1, Repeat{}});
 
-					// Token ends with '$' followed by only one char (partial $N)
-					if (i + len < text_length && (text[i + len - 1] == '$' || text[i + len - 2] == '$')) continue;
+	pool.run(ranges.size(), [&](size_t i) {
+		auto& [best_score, best_repeat] = shards[i];
 
-					std::string sub = text.substr(i, len);
+		// Only the longest length of each repeat is scored, shorter ones share its count and score lower
+		for_each_repeat(index, minTokenSize, maxTokenSize, ranges[i], [&](const Repeat& repeat) {
+			int token_length = (int)repeat.length;
+			int count = (int)repeat.count;
+			int score = token_length * (count - 1) - count * long_rep - TOKEN_STORAGE_COST;
 
-					occurrences[sub]++;
-				}
+			if (score > best_score || (score == best_score && preferred(repeat, best_repeat))) {
+				best_score = score;
+				best_repeat = repeat;
 			}
-		}
-	}
+		});
+	});
 
 	TokenInfo best_token = {"", -1};
-	// Calculate scores
-	for (const auto& [token, count] : occurrences) {
-		// Only interesting if the string appears more than once
-		if (count > 1) {
-			int token_length = (int)token.size();
-			int long_rep = find_large ? 3 : 1;
-			int score = token_length * (count - 1) - count * long_rep - 1;
-
-			// Keep only the best token
-			if (score > best_token.score) {
-				best_token = { token, score };
-			}
+	Repeat best_repeat = {};
+	for (const auto& [score, repeat] : shards) {
+		if (score > best_token.score || (score == best_token.score && score > -1 && preferred(repeat, best_repeat))) {
+			best_token.score = score;
+			best_repeat = repeat;
 		}
 	}
 
+	if (best_token.score > -1) {
+		best_token.token = repeat_string(index, best_repeat);
+		best_token.count = (int)best_repeat.count;
+	}
+
 	return best_token;
 }
 
+// Rewrites a text in place while matches are found from left to right, a replacement is never longer than its token.
+// Bytes from `read` onwards are still the original ones, the two original bytes before `read` are kept aside.
+struct InPlaceRewriter {
+	std::string& text;
+	std::vector<size_t>* sites;
+	size_t read = 0;
+	size_t write = 0;
+	char before1 = 0;
+	char before2 = 0;
+
+	// Original byte at a position, which must not be more than two bytes before `read`
+	char original(size_t pos) const {
+		if (pos >= read) return text[pos];
+		return (pos + 1 == read) ? before1 : before2;
+	}
+
+	// A token may not start one or two bytes after a '$', that is inside a '$' escape
+	bool valid_start(size_t pos) const {
+		if (pos >= 1 && original(pos - 1) == '$') return false;
+		if (pos >= 2 && original(pos - 2) == '$') return false;
+		return true;
+	}
+
+	void replace(size_t pos, const std::string& token, const std::string& replacement) {
+		char last1 = token.back();
+		char last2 = token.size() >= 2 ? token[token.size() - 2] : (pos >= 1 ? original(pos - 1) : 0);
+
+		if (write != read) std::memmove(&text[write], &text[read], pos - read);
+		write += pos - read;
+
+		if (sites) sites->push_back(write);
+		std::memcpy(&text[write], replacement.data(), replacement.size());
+		write += replacement.size();
+
+		read = pos + token.size();
+		before1 = last1;
+		before2 = last2;
+	}
+
+	void finish() {
+		if (write == read) return;
+		size_t tail = text.size() - read;
+		std::memmove(&text[write], &text[read], tail);
+		text.resize(write + tail);
+	}
+};
+
+// Function to replace a token in a text in place, optionally recording where the replacements start in the new text.
+// Candidates are found with std::string_view::find, which filters on the first byte with the vectorized memchr.
+void replace_token(std::string& text, const std::string& token, const std::string& replacement, std::vector<size_t>* sites) {
+	if (token.empty()) return;
+	if (replacement.size() > token.size()) {
+		throw std::runtime_error("Error: Replacement longer than the token it replaces.");
+	}
+
+	InPlaceRewriter rewriter{text, sites};
+
+	// Bytes from the search position onwards have not been rewritten yet
+	std::string_view view = text;
+	size_t pos = view.find(token);
+	while (pos != std::string_view::npos) {
+		if (rewriter.valid_start(pos)) {
+			rewriter.replace(pos, token, replacement);
+			pos = view.find(token, pos + token.size());
+		}
+		else {
+			pos = view.find(token, pos + 1);
+		}
+	}
+
+	rewriter.finish();
+}
+
+// Function to count the occurrences of a token that do not start inside a '$' escape, overlapping ones included
+int count_token(std::string_view text, std::string_view token) {
+	int count = 0;
+	for (size_t pos = text.find(token); pos != std::string_view::npos; pos = text.find(token, pos + 1)) {
+		if ((pos >= 1 && text[pos - 1] == '$') || (pos >= 2 && text[pos - 2] == '$')) continue;
+		count++;
+	}
+	return count;
+}
+
 // Function to replace tokens in the text with a replacement string
 void replace_tokens(std::unordered_map<std::string, std::string>& texts, const std::string& token, const std::string& replacement) {
 	for (auto& [name, text] : texts) {
-		std::ostringstream oss;
-		std::size_t pos = 0, last_pos = 0;
-
-		while ((pos = text.find(token, pos)) != std::string::npos) {
-			oss.write(text.data() + last_pos, pos - last_pos);
-			oss << replacement;
-			pos += token.size();
-			last_pos = pos;
+		replace_token(text, token, replacement, nullptr);
+	}
+}
+
+// Function to index a batch of replacements by the first byte of their token
+ReplacementBatch make_replacement_batch(std::vector<std::pair<std::string, std::string>> replacements) {
+	ReplacementBatch batch;
+	batch.first.assign(256, -1);
+	batch.next.assign(replacements.size(), -1);
+
+	// Chains are built backwards so that earlier replacements are tried first
+	for (size_t i = replacements.size(); i-- > 0;) {
+		const auto& [token, replacement] = replacements[i];
+		if (token.empty()) continue;
+		if (replacement.size() > token.size()) {
+			throw std::runtime_error("Error: Replacement longer than the token it replaces.");
 		}
-		oss.write(text.data() + last_pos, text.size() - last_pos);
-		text = oss.str();
+
+		uint8_t c = static_cast<uint8_t>(token[0]);
+		batch.next[i] = batch.first[c];
+		batch.first[c] = (int32_t)i;
+	}
+
+	batch.replacements = std::move(replacements);
+	return batch;
+}
+
+// Function to apply a batch of replacements in a single pass over a text
+void replace_tokens(std::string& text, const ReplacementBatch& batch, std::vector<size_t>* sites) {
+	InPlaceRewriter rewriter{text, sites};
+	const size_t n = text.size();
+
+	size_t pos = 0;
+	while (pos < n) {
+		size_t matched = 0;
+		for (int32_t i = batch.first[static_cast<uint8_t>(text[pos])]; i >= 0; i = batch.next[i]) {
+			const auto& [token, replacement] = batch.replacements[i];
+			if (pos + token.size() <= n && std::memcmp(text.data() + pos, token.data(), token.size()) == 0 && rewriter.valid_start(pos)) {
+				rewriter.replace(pos, token, replacement);
+				matched = token.size();
+				break;
+			}
+		}
+		pos += matched ? matched : 1;
+	}
+
+	rewriter.finish();
+}
+
+// Function to apply a batch of replacements to every text
+void replace_tokens(std::unordered_map<std::string, std::string>& texts, const ReplacementBatch& batch) {
+	for (auto& [name, text] : texts) {
+		replace_tokens(text, batch, nullptr);
+	}
+}
+
+// Function to get the replacement of the multi-character token at an index of the token list
+std::string token_reference(size_t token_index) {
+	std::string replacement = "$";
+	replacement += static_cast<char>(token_index & 0xFF);
+	replacement += static_cast<char>((token_index >> 8) & 0xFF);
+	return replacement;
+}
+
+// Function to encode a text with an existing dictionary, replacing its tokens in the order they were found,
+// which gives the same text as compress_texts did for the texts it compressed
+void encode_text(std::string& text, const Tokens& tokens) {
+	for (int token_value = 128; token_value <= 255; token_value++) {
+		auto it = tokens.token_char_map.find((uint8_t)token_value);
+		if (it == tokens.token_char_map.end()) break;
+		replace_token(text, it->second, std::string(1, static_cast<char>(token_value)), nullptr);
+	}
+
+	for (size_t token_index = 0; token_index < tokens.token_list.size(); token_index++) {
+		replace_token(text, tokens.token_list.at((uint16_t)token_index), token_reference(token_index), nullptr);
 	}
 }
 
 // Function to compress texts by finding and replacing tokens
-Tokens compress_texts(std::unordered_map<std::string, std::string>& texts, size_t minTokenSize, size_t maxTokenSize, bool verbose) {
+// Stops with the tokens found so far once the time budget is over. With a beam width above 1, each token is chosen
+// among that many best ones by looking LOOKAHEAD_STEPS replacements ahead instead of greedily.
+Tokens compress_texts(std::unordered_map<std::string, std::string>& texts, size_t minTokenSize, size_t maxTokenSize, ThreadPool& pool, const CompressionBudget& budget, size_t beamWidth, bool verbose) {
 	std::unordered_map<uint8_t, std::string> token_char_map;
 	std::unordered_map<uint16_t, std::string> token_list;
+	CompressionStats stats;
 
 	if (verbose) {
 		std::cout << "Compressing texts with minTokenSize: " << minTokenSize;
 		if (maxTokenSize > 0) {
 			std::cout << ", maxTokenSize: " << maxTokenSize;
 		}
+		std::cout << ", threads: " << pool.size();
+		if (beamWidth > 1) {
+			std::cout << ", beam width: " << beamWidth;
+		}
 		std::cout << std::endl;
 	}
 
+	OccurrenceIndex index(texts, minTokenSize, maxTokenSize, budget, pool);
+	index.build(false);
+
+	// Records what finding each token cost, the iteration ending once the token is replaced
+	std::chrono::steady_clock::time_point iteration_start;
+	uint64_t iteration_allocations = 0;
+	auto start_iteration = [&]() {
+		iteration_start = std::chrono::steady_clock::now();
+		iteration_allocations = allocation_count.load(std::memory_order_relaxed);
+	};
+	auto end_iteration = [&](const TokenInfo& token, bool single_char) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - iteration_start;
+		stats.iterations.push_back({token.token.length(), token.score, token.count, single_char, elapsed.count(), allocation_count.load(std::memory_order_relaxed) - iteration_allocations});
+	};
+
+	// The best token, or with a beam the one saving the most over the next replacements, given by their own lambda
+	auto find_token = [&](size_t remaining, const std::function<std::string(size_t)>& replacement) {
+		if (beamWidth <= 1) return index.best();
+
+		std::vector<std::string> replacements;
+		for (size_t step = 0; step < std::min(remaining, LOOKAHEAD_STEPS); step++) replacements.push_back(replacement(step));
+		return index.best_lookahead(beamWidth, replacements);
+	};
+
 	// Find and replace single-character tokens
 	for (int token_value = 128; token_value <= 255; token_value++) {
-		TokenInfo best_token = find_best_token(texts, false, minTokenSize, maxTokenSize, verbose);
+		start_iteration();
+		TokenInfo best_token = find_token(256 - token_value, [&](size_t step) {
+			return std::string(1, static_cast<char>(token_value + step));
+		});
 		if (best_token.score <= 0 || best_token.token.empty()) {
 			break;
 		}
@@ -97,38 +293,45 @@ Tokens compress_texts(std::unordered_map<std::string, std::string>& texts, size_
 
 		token_char_map[token_value] = best_token.token;
 		std::string replacement = std::string(1, static_cast<uint8_t>(token_value));
-		replace_tokens(texts, best_token.token, replacement);
+		index.replace(best_token.token, replacement);
+		end_iteration(best_token, true);
 	}
 
 	if (verbose) {
 		std::cout << "Found " << token_char_map.size() << " single-character tokens." << std::endl;
 	}
 
-	size_t offset = 0;
-	// Find and replace multi-character tokens
-	while (offset < std::numeric_limits<uint16_t>::max()) {
-		TokenInfo best_token = find_best_token(texts, true, minTokenSize, maxTokenSize, verbose);
+	if (!index.interrupted()) index.build(true);
+
+	// Find and replace multi-character tokens, each one referenced by its index in the token list
+	for (size_t token_index = 0; token_index <= std::numeric_limits<uint16_t>::max(); token_index++) {
+		start_iteration();
+		TokenInfo best_token = find_token(std::numeric_limits<uint16_t>::max() + 1 - token_index, [&](size_t step) {
+			return token_reference(token_index + step);
+		});
 		if (best_token.score <= 0 || best_token.token.empty()) {
 			break;
 		}
 
 		if (verbose) {
-			std::cout << "Best token found (" << offset << "), of length " << best_token.token.length() << " and with score: " << best_token.score << std::endl;
+			std::cout << "Best token found (" << token_index << "), of length " << best_token.token.length() << " and with score: " << best_token.score << std::endl;
 		}
 
-		token_list.insert({(uint16_t)offset, best_token.token});
-
-		std::string replacement = "$";
-		replacement += static_cast<char>(offset & 0xFF);
-		replacement += static_cast<char>((offset >> 8) & 0xFF);
-		replace_tokens(texts, best_token.token, replacement);
-
-		offset += best_token.token.size() + 1;
+		token_list.insert({(uint16_t)token_index, best_token.token});
+		index.replace(best_token.token, token_reference(token_index));
+		end_iteration(best_token, false);
 	}
 
 	if (verbose && !token_list.empty()) {
 		std::cout << "Found " << token_list.size() << " multi-character tokens." << std::endl;
 	}
 
-	return {token_char_map, token_list};
+	if (index.interrupted()) {
+		stats.time_budget_reached = true;
+		stats.next_token_score = index.next_score();
+	}
+	stats.indexed_fraction = index.indexed_fraction();
+	stats.dropped_candidates = index.dropped_candidates();
+
+	return {token_char_map, token_list, stats};
 }
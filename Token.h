@@ -3,16 +3,49 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
+
+#include "Stats.h"
+#include "ThreadPool.h"
+
+// Bytes a token takes in the pack besides its content: a NUL terminator and its entry in the token table
+constexpr int TOKEN_STORAGE_COST = 9;
 
 struct TokenInfo {
 	std::string token;
 	int score;
+	int count = 0; // Occurrences, when known
+};
+
+// Token replacements applied together in a single pass, tokens of a batch should not overlap each other
+// otherwise the first one listed wins where several match
+struct ReplacementBatch {
+	std::vector<std::pair<std::string, std::string>> replacements;
+	std::vector<int32_t> first; // First replacement whose token starts with each byte, -1 if none
+	std::vector<int32_t> next;  // Next replacement whose token starts with the same byte
+};
+
+// Limits of a compression run, 0 meaning unlimited. Once one is reached, the tokens found so far are kept.
+struct CompressionBudget {
+	size_t time_ms = 0;
+	size_t memory_bytes = 0; // Memory used to index the candidate tokens
+};
+
+// What a compression run gave up to stay within its budget
+struct CompressionStats {
+	bool time_budget_reached = false;
+	int next_token_score = 0;       // Bytes the next token would have saved when the time budget was reached
+	double indexed_fraction = 1.0;  // Smallest part of the texts indexed at once within the memory budget
+	size_t dropped_candidates = 0;  // Candidate tokens dropped to stay within the memory budget
+	std::vector<TokenSearchStats> iterations; // Token found by each iteration of the search, empty if there was none
 };
 
 struct Tokens {
 	std::unordered_map<uint8_t, std::string> token_char_map;
 	std::unordered_map<uint16_t, std::string> token_list;
+	CompressionStats stats;
 };
 
 TokenInfo find_best_token(
@@ -20,12 +53,47 @@ TokenInfo find_best_token(
 	bool find_large,
 	size_t minTokenSize,
 	size_t maxTokenSize,
-	bool verbose
+	ThreadPool& pool
+);
+
+int count_token(std::string_view text, std::string_view token);
+
+void replace_token(
+	std::string& text,
+	const std::string& token,
+	const std::string& replacement,
+	std::vector<size_t>* sites
 );
 
+void replace_tokens(
+	std::unordered_map<std::string, std::string>& texts,
+	const std::string& token,
+	const std::string& replacement
+);
+
+ReplacementBatch make_replacement_batch(std::vector<std::pair<std::string, std::string>> replacements);
+
+void replace_tokens(
+	std::string& text,
+	const ReplacementBatch& batch,
+	std::vector<size_t>* sites
+);
+
+void replace_tokens(
+	std::unordered_map<std::string, std::string>& texts,
+	const ReplacementBatch& batch
+);
+
+std::string token_reference(size_t token_index);
+
+void encode_text(std::string& text, const Tokens& tokens);
+
 Tokens compress_texts(
 	std::unordered_map<std::string, std::string>& texts,
 	size_t minTokenSize,
 	size_t maxTokenSize,
+	ThreadPool& pool,
+	const CompressionBudget& budget,
+	size_t beamWidth,
 	bool verbose
 );
@@ -0,0 +1,93 @@
+#include "Unpacker.h"
+#include "PackFormat.h"
+
+#include <stdexcept>
+
+// Reads a header field, checking the header is there
+static uint32_t pack_field(const std::vector<uint8_t>& pack, PackField field) {
+	return read_u32(&pack[field * 4]);
+}
+
+// Reads the offset and expanded length of a token, checking it is in the table
+static const uint8_t* token_entry(const std::vector<uint8_t>& pack, PackField countField, PackField tableField, size_t index) {
+	if (index >= pack_field(pack, countField)) {
+		throw std::runtime_error("Error: Invalid token in pack.");
+	}
+	return &pack[pack_field(pack, tableField) + index * TOKEN_ENTRY_SIZE];
+}
+
+// Function to unpack every shader of a pack in table order, like the generated unpackShader
+std::vector<std::string> unpack_shaders(const std::vector<uint8_t>& pack, const HuffmanDecoder* decoder) {
+	if (pack.size() < HEADER_SIZE || pack_field(pack, FIELD_MAGIC) != PACK_MAGIC || pack_field(pack, FIELD_FORMAT) != PACK_FORMAT) {
+		throw std::runtime_error("Error: Not a shader pack of format " + std::to_string(PACK_FORMAT) + ".");
+	}
+	if (pack_field(pack, FIELD_SIZE) != pack.size() || pack_field(pack, FIELD_CHECKSUM) != fnv1a(&pack[16], pack.size() - 16)) {
+		throw std::runtime_error("Error: Corrupted shader pack.");
+	}
+
+	bool entropyCoded = pack_field(pack, FIELD_ENTROPY_CODE) != 0;
+	if (entropyCoded && !decoder) {
+		throw std::runtime_error("Error: Shader pack is entropy coded.");
+	}
+
+	const char* version = reinterpret_cast<const char*>(&pack[pack_field(pack, FIELD_VERSION_OFFSET)]);
+	size_t versionLength = pack_field(pack, FIELD_VERSION_LENGTH);
+
+	std::vector<std::string> sources;
+	std::vector<const uint8_t*> stack;
+	std::string stream;
+	for (size_t i = 0; i < pack_field(pack, FIELD_SHADER_COUNT); i++) {
+		const uint8_t* entry = &pack[pack_field(pack, FIELD_SHADER_TABLE) + i * SHADER_ENTRY_SIZE];
+		const uint8_t* read = &pack[read_u32(entry + 8)];
+		size_t length = read_u32(entry + 12);
+
+		if (entropyCoded) {
+			stream.resize(read_u32(read));
+			huffman_decode(read + ENTROPY_PREFIX_SIZE, reinterpret_cast<uint8_t*>(stream.data()), stream.size(), *decoder);
+			if (stream.empty() || stream.back() != '\0') {
+				throw std::runtime_error("Error: Invalid entropy coded shader.");
+			}
+			read = reinterpret_cast<const uint8_t*>(stream.data());
+		}
+
+		std::string source(version, versionLength);
+		source.reserve(length);
+		stack.clear();
+		while (true) {
+			uint8_t c = *read++;
+			if (c == '\0') {
+				if (stack.empty()) break;
+				read = stack.back();
+				stack.pop_back();
+				continue;
+			}
+
+			const uint8_t* token = nullptr;
+			if (c == '$') {
+				size_t index = read[0] | (read[1] << 8);
+				token = token_entry(pack, FIELD_PACK_TOKEN_COUNT, FIELD_PACK_TOKEN_TABLE, index);
+				read += 2;
+			}
+			else if (c >= 128) {
+				token = token_entry(pack, FIELD_CHAR_TOKEN_COUNT, FIELD_CHAR_TOKEN_TABLE, c - 128);
+			}
+			else {
+				source.push_back((char)c);
+				continue;
+			}
+
+			if (stack.size() == pack_field(pack, FIELD_MAX_TOKEN_DEPTH)) {
+				throw std::runtime_error("Error: Tokens of the shader pack nest too deep.");
+			}
+			stack.push_back(read);
+			read = &pack[read_u32(token)];
+		}
+
+		if (source.size() != length) {
+			throw std::runtime_error("Error: Unpacked shader length does not match the shader table.");
+		}
+		sources.push_back(std::move(source));
+	}
+
+	return sources;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Entropy.h"
+
+// Function to unpack every shader of a pack in table order, like the generated unpackShader.
+// Entropy coded packs need the decoder of their code. Throws if the pack is invalid.
+std::vector<std::string> unpack_shaders(const std::vector<uint8_t>& pack, const HuffmanDecoder* decoder);
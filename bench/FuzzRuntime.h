@@ -0,0 +1,21 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#include "Entropy.h"
+#include "ShaderCorpus.h"
+
+// Deepest token nesting the decompressors compiled into the benchmarks accept
+constexpr size_t RUNTIME_MAX_TOKEN_DEPTH = 1024;
+
+// Huffman code the entropy coding decompressor is generated with, learned from a synthetic corpus.
+// Every byte gets a code, so that any compressed shader can be coded with it.
+inline HuffmanCode runtimeEntropyCode() {
+	std::array<size_t, 256> frequencies;
+	frequencies.fill(1);
+	for (const auto& [name, shader] : generateCorpus(12345, 64 * 1024, 4 * 1024)) {
+		for (char c : shader) frequencies[(uint8_t)c]++;
+	}
+	return build_huffman_code(frequencies);
+}
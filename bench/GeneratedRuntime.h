@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Decompressors emitted by generateCFile, written at build time by generate_runtime and compiled as C++,
+// each in its own namespace. Their macros are removed after each one, so that they do not leak into the benchmarks.
+
+namespace generated {
+	#include "runtime_plain.c"
+}
+
+#undef SHADER_PACK_MAGIC
+#undef SHADER_PACK_FORMAT
+#undef SHADER_NOT_FOUND
+#undef MAX_TOKEN_DEPTH
+#undef ENTROPY_CODE
+#undef HEADER_SIZE
+#undef SHADER_ENTRY_SIZE
+#undef TOKEN_ENTRY_SIZE
+#undef ENTROPY_PREFIX_SIZE
+
+namespace generated_entropy {
+	#include "runtime_entropy.c"
+}
+
+#undef SHADER_PACK_MAGIC
+#undef SHADER_PACK_FORMAT
+#undef SHADER_NOT_FOUND
+#undef MAX_TOKEN_DEPTH
+#undef ENTROPY_CODE
+#undef HUFFMAN_TABLE_BITS
+#undef HUFFMAN_MAX_LENGTH
+#undef HEADER_SIZE
+#undef SHADER_ENTRY_SIZE
+#undef TOKEN_ENTRY_SIZE
+#undef ENTROPY_PREFIX_SIZE
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// Deterministic generator of GLSL-like shaders
+inline std::string generateShader(uint32_t& seed, size_t length) {
+	static const char* types[] = {"float", "vec2", "vec3", "vec4", "mat3", "mat4"};
+	static const char* names[] = {"color", "normal", "lightDir", "viewDir", "diffuse", "specular", "position", "uv", "shadow", "fog"};
+	static const char* calls[] = {"normalize", "dot", "max", "mix", "texture", "pow", "clamp", "reflect"};
+
+	auto next = [&](uint32_t range) {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	};
+
+	std::string shader = "uniform mat4 model;\nuniform vec3 lightPos;\nin vec3 FragPos;\nout vec4 FragColor;\n\nvoid main() {\n";
+	while (shader.size() < length) {
+		shader += "\t";
+		shader += types[next(6)];
+		shader += " ";
+		shader += names[next(10)];
+		shader += std::to_string(next(8));
+		shader += " = ";
+		shader += calls[next(8)];
+		shader += "(";
+		shader += names[next(10)];
+		shader += ", ";
+		shader += names[next(10)];
+		shader += " * " + std::to_string(next(100)) + ".0);\n";
+	}
+	shader += "}\n";
+
+	return shader;
+}
+
+// Deterministic generator of a corpus of complete shader sources, with a version directive and uniforms and
+// varyings drawn from a shared pool, totalling at least the given size
+inline std::unordered_map<std::string, std::string> generateCorpus(uint32_t seed, size_t corpusSize, size_t shaderSize) {
+	static const char* uniforms[] = {"model", "view", "projection", "time", "lightPos", "lightColor", "cameraPos", "exposure", "albedoMap", "normalMap"};
+	static const char* varyings[] = {"FragPos", "Normal", "TexCoord", "Tangent", "WorldPos", "ViewPos"};
+
+	auto next = [&](uint32_t range) {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	};
+
+	std::unordered_map<std::string, std::string> corpus;
+	size_t total = 0;
+	while (total < corpusSize) {
+		std::string shader = "#version " + std::to_string(330 + next(2) * 100) + " core\n";
+		for (int i = 0; i < 3; i++) shader += std::string("uniform vec4 ") + uniforms[next(10)] + std::to_string(i) + ";\n";
+		for (int i = 0; i < 2; i++) shader += std::string("in vec3 ") + varyings[next(6)] + std::to_string(i) + ";\n";
+
+		std::string body = generateShader(seed, shaderSize);
+		shader += body.substr(body.find("void main"));
+
+		total += shader.size();
+		corpus["shaders/shader" + std::to_string(corpus.size()) + ".frag"] = std::move(shader);
+	}
+
+	return corpus;
+}
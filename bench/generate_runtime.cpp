@@ -0,0 +1,18 @@
+// Writes the decompressors emitted by generateCFile, with and without entropy coding, for the benchmarks to compile
+#include "OutputGenerator.h"
+#include "FileUtils.h"
+#include "FuzzRuntime.h"
+
+#include <iostream>
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		std::cerr << "Usage: " << argv[0] << " <plain_c_file> <entropy_c_file>" << std::endl;
+		return 1;
+	}
+
+	HuffmanCode code = runtimeEntropyCode();
+	writeFile(argv[1], generateCFile({}, RUNTIME_MAX_TOKEN_DEPTH, nullptr));
+	writeFile(argv[2], generateCFile({}, RUNTIME_MAX_TOKEN_DEPTH, &code));
+	return 0;
+}
@@ -0,0 +1,174 @@
+// Measures each phase of packing a synthetic corpus as it grows, from renaming the externals to unpacking the pack
+// with the generated decompressor, and writes the results as JSON to compare them between commits
+#include "Token.h"
+#include "ShaderUtils.h"
+#include "OutputGenerator.h"
+#include "ShaderCorpus.h"
+#include "GeneratedRuntime.h"
+#include "PeakMemory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct PhaseResult {
+	const char* name;
+	size_t bytes;   // Sources for the front-end, renamed texts for the search and packing, unpacked shaders for unpacking
+	double seconds;
+};
+
+struct CorpusResult {
+	size_t corpusBytes;
+	size_t shaders;
+	size_t packBytes;
+	size_t peakRSSKB;
+	std::vector<PhaseResult> phases;
+};
+
+// Returns the seconds taken by a function
+template <typename Function>
+static double timeOnce(Function function) {
+	auto start = std::chrono::steady_clock::now();
+	function();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+// Runs a function for at least a tenth of a second, returning the seconds per run
+template <typename Function>
+static double timeRepeated(Function function) {
+	size_t runs = 0;
+	auto start = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed{};
+	do {
+		function();
+		runs++;
+		elapsed = std::chrono::steady_clock::now() - start;
+	} while (elapsed.count() < 0.1);
+	return elapsed.count() / runs;
+}
+
+static bool benchCorpus(size_t corpusSize, size_t threads, CorpusResult& result) {
+	// Shaders of at most 8KB, smaller ones for the smallest corpora to still have a few of them
+	const size_t shaderSize = std::min((size_t)8 * 1024, corpusSize / 4);
+
+	std::unordered_map<std::string, std::string> sources = generateCorpus(12345, corpusSize, shaderSize);
+	result.shaders = sources.size();
+	result.corpusBytes = 0;
+	for (const auto& [name, source] : sources) result.corpusBytes += source.size();
+
+	// Front-end: version extraction and renaming of the externals
+	std::unordered_map<std::string, std::string> texts;
+	std::unordered_map<std::string, std::string> globalUniformMap;
+	std::unordered_map<std::string, std::string> globalInOutMap;
+	int glslVersion = 0;
+	double frontEnd = timeOnce([&]() {
+		for (const auto& [name, source] : sources) {
+			std::string code = source;
+			glslVersion = std::max(glslVersion, extractGLSLVersion(code));
+			removeGLSLVersionDirective(code);
+			texts[name] = extractExternals(std::move(code), globalUniformMap, globalInOutMap, false);
+		}
+	});
+	result.phases.push_back({"extractExternals", result.corpusBytes, frontEnd});
+
+	size_t textBytes = 0;
+	for (const auto& [name, text] : texts) textBytes += text.size();
+
+	// Token search, compressing the texts in place
+	ThreadPool pool(threads);
+	Tokens tokens;
+	double search = timeOnce([&]() {
+		tokens = compress_texts(texts, 3, 0, pool, CompressionBudget{}, 1, false);
+	});
+	result.phases.push_back({"compress_texts", textBytes, search});
+
+	// Packing
+	std::vector<uint8_t> pack;
+	double packing = timeOnce([&]() {
+		TokenExpansion expansion = expandTokens(tokens.token_char_map, tokens.token_list);
+		std::vector<std::pair<std::string, size_t>> shadersOffsets;
+		std::vector<size_t> shaderLengths;
+		pack = generatePackedContent(texts, tokens.token_char_map, tokens.token_list, expansion, "#version " + std::to_string(glslVersion) + " core", nullptr, shadersOffsets, shaderLengths);
+	});
+	result.phases.push_back({"generatePackedContent", textBytes, packing});
+	result.packBytes = pack.size();
+
+	// Unpacking every shader with the generated decompressor
+	const char* text = (const char*)pack.data();
+	if (!generated::verifyShaderPack(text, pack.size())) {
+		std::cerr << "Invalid pack for a corpus of " << result.corpusBytes << " bytes" << std::endl;
+		return false;
+	}
+
+	size_t totalLength = generated::getShadersTotalLength(text);
+	std::vector<char> arena(totalLength);
+	std::vector<const char*> shaderSources(generated::getShaderCount(text));
+	double unpacking = timeRepeated([&]() {
+		generated::unpackAllShaders(text, arena.data(), arena.size(), shaderSources.data());
+	});
+	result.phases.push_back({"unpackAllShaders", totalLength - shaderSources.size(), unpacking});
+
+	result.peakRSSKB = peakMemoryKB();
+	return true;
+}
+
+static std::string toJSON(size_t threads, const std::vector<CorpusResult>& results) {
+	std::ostringstream json;
+	json << "{\n\t\"benchmark\": \"pipeline_bench\",\n\t\"threads\": " << threads << ",\n\t\"corpora\": [";
+	for (size_t i = 0; i < results.size(); i++) {
+		const CorpusResult& result = results[i];
+		json << (i ? "," : "") << "\n\t\t{\n"
+			<< "\t\t\t\"corpus_bytes\": " << result.corpusBytes << ",\n"
+			<< "\t\t\t\"shaders\": " << result.shaders << ",\n"
+			<< "\t\t\t\"pack_bytes\": " << result.packBytes << ",\n"
+			<< "\t\t\t\"peak_rss_kb\": " << result.peakRSSKB << ",\n"
+			<< "\t\t\t\"phases\": {";
+		for (size_t j = 0; j < result.phases.size(); j++) {
+			const PhaseResult& phase = result.phases[j];
+			json << (j ? "," : "") << "\n\t\t\t\t\"" << phase.name << "\": {\"bytes\": " << phase.bytes
+				<< ", \"seconds\": " << phase.seconds << ", \"bytes_per_second\": " << phase.bytes / phase.seconds << "}";
+		}
+		json << "\n\t\t\t}\n\t\t}";
+	}
+	json << "\n\t]\n}\n";
+	return json.str();
+}
+
+int main(int argc, char** argv) {
+	size_t maxCorpusSize = (argc > 1) ? std::stoull(argv[1]) : (size_t)1 << 20;
+	size_t threads = (argc > 2) ? std::stoull(argv[2]) : 1;
+	std::string jsonPath = (argc > 3) ? argv[3] : "pipeline_bench.json";
+
+	std::cout << "corpus_bytes,shaders,phase,seconds,mb_per_s,peak_rss_kb" << std::endl;
+
+	// Corpora double from 10KB, the last one being exactly the maximum size
+	std::vector<CorpusResult> results;
+	for (size_t corpusSize = std::min((size_t)10 * 1024, maxCorpusSize);; corpusSize = std::min(corpusSize * 2, maxCorpusSize)) {
+		CorpusResult result;
+		if (!benchCorpus(corpusSize, threads, result)) return 1;
+
+		for (const PhaseResult& phase : result.phases) {
+			std::cout << result.corpusBytes << "," << result.shaders << "," << phase.name << "," << phase.seconds << ","
+				<< phase.bytes / phase.seconds / (1024 * 1024) << "," << result.peakRSSKB << std::endl;
+		}
+		results.push_back(std::move(result));
+
+		if (corpusSize == maxCorpusSize) break;
+	}
+
+	std::ofstream json(jsonPath);
+	if (!json) {
+		std::cerr << "Failed to open file for writing: " << jsonPath << std::endl;
+		return 1;
+	}
+	json << toJSON(threads, results);
+
+	return 0;
+}
@@ -0,0 +1,202 @@
+#include "Crusher.h"
+#include "OutputGenerator.h"
+#include "Token.h"
+#include "Unpacker.h"
+#include "FuzzRuntime.h"
+#include "GeneratedRuntime.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Bytes of the shaders built from the input, GLSL having no '$'
+static const char ALPHABET[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_ \t\n;,.()[]{}+-*/=<>!&|#";
+
+static const std::string GLSL_VERSION = "#version 330 core";
+
+// Entry points of a generated decompressor
+struct Runtime {
+	const char* name;
+	int (*verifyShaderPack)(const char*, size_t);
+	size_t (*getShaderCount)(const char*);
+	size_t (*getShadersTotalLength)(const char*);
+	size_t (*getShaderOffset)(const char*, size_t);
+	size_t (*getShaderLength)(const char*, size_t);
+	char* (*getShaderSourceFromFile)(const char*, size_t);
+	size_t (*unpackShader)(const char*, size_t, char*, size_t);
+	int (*unpackAllShaders)(const char*, char*, size_t, const char**);
+	size_t decodedBytes = 0; // Decoding done by unpackAllShaders over all the inputs, reported at exit
+	double decodeSeconds = 0;
+};
+
+#define RUNTIME_ENTRY_POINTS(ns) \
+	ns::verifyShaderPack, ns::getShaderCount, ns::getShadersTotalLength, ns::getShaderOffset, ns::getShaderLength, \
+	ns::getShaderSourceFromFile, ns::unpackShader, ns::unpackAllShaders
+
+static Runtime plainRuntime = {"plain", RUNTIME_ENTRY_POINTS(generated)};
+static Runtime entropyRuntime = {"entropy", RUNTIME_ENTRY_POINTS(generated_entropy)};
+
+static size_t corpora = 0;
+
+static void reportDecoding() {
+	std::cout << "runtime,corpora,decoded_bytes,decode_mb_per_s" << std::endl;
+	for (const Runtime* runtime : {&plainRuntime, &entropyRuntime}) {
+		std::cout << runtime->name << "," << corpora << "," << runtime->decodedBytes << ","
+			<< (runtime->decodeSeconds > 0 ? runtime->decodedBytes / runtime->decodeSeconds / 1e6 : 0.0) << std::endl;
+	}
+}
+
+static void fail(const Runtime& runtime, const std::string& message) {
+	std::cerr << runtime.name << " decompressor: " << message << std::endl;
+	std::abort();
+}
+
+// Builds a corpus of ASCII shaders from arbitrary bytes. 0xFF starts a new shader, other bytes from 0x80 repeat a
+// slice of the shader so far, so that the compressor finds tokens, and the rest are characters.
+static std::unordered_map<std::string, std::string> corpusFromBytes(const uint8_t* data, size_t size) {
+	std::vector<std::string> shaders(1);
+	for (size_t i = 0; i < size; i++) {
+		uint8_t b = data[i];
+		std::string& shader = shaders.back();
+		if (b == 0xFF) {
+			shaders.emplace_back();
+		}
+		else if (b >= 0x80 && !shader.empty() && i + 1 < size) {
+			size_t start = data[++i] % shader.size();
+			size_t length = (b & 0x3F) + 3;
+			for (size_t j = 0; j < length; j++) shader += shader[start + j];
+		}
+		else {
+			shader += ALPHABET[b % (sizeof(ALPHABET) - 1)];
+		}
+	}
+
+	std::unordered_map<std::string, std::string> corpus;
+	for (size_t i = 0; i < shaders.size(); i++) corpus["./fuzz" + std::to_string(i) + ".frag"] = std::move(shaders[i]);
+	return corpus;
+}
+
+// Packs a corpus with verification, with and without entropy coding. A shader unpacking to anything else throws.
+static void checkCrusher(const std::unordered_map<std::string, std::string>& corpus) {
+	for (bool entropy : {false, true}) {
+		CrusherOptions options;
+		options.verify = true;
+		options.entropy = entropy;
+		Crusher crusher(options);
+		for (const auto& [name, source] : corpus) crusher.setShader(name, source);
+		crusher.crush();
+	}
+}
+
+// Checks every entry point of a generated decompressor unpacks the expected shaders
+static void checkRuntime(Runtime& runtime, const std::vector<uint8_t>& packContent, const std::vector<std::string>& expected) {
+	const char* pack = (const char*)packContent.data();
+	if (!runtime.verifyShaderPack(pack, packContent.size())) fail(runtime, "invalid pack");
+
+	size_t shaderCount = runtime.getShaderCount(pack);
+	if (shaderCount != expected.size()) fail(runtime, "wrong shader count");
+
+	std::vector<char> arena(runtime.getShadersTotalLength(pack));
+	std::vector<const char*> sources(shaderCount);
+
+	auto start = std::chrono::steady_clock::now();
+	int unpacked = runtime.unpackAllShaders(pack, arena.data(), arena.size(), sources.data());
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	if (!unpacked) fail(runtime, "unpackAllShaders failed");
+
+	std::vector<char> buffer;
+	for (size_t i = 0; i < shaderCount; i++) {
+		size_t offset = runtime.getShaderOffset(pack, i);
+		if (expected[i] != sources[i] || runtime.getShaderLength(pack, i) != expected[i].size()) {
+			fail(runtime, "unpackAllShaders disagrees on shader " + std::to_string(i));
+		}
+
+		buffer.assign(expected[i].size() + 1, '\0');
+		if (runtime.unpackShader(pack, offset, buffer.data(), buffer.size()) != expected[i].size() || expected[i] != buffer.data()) {
+			fail(runtime, "unpackShader disagrees on shader " + std::to_string(i));
+		}
+
+		char* source = runtime.getShaderSourceFromFile(pack, offset);
+		bool same = source && expected[i] == source;
+		std::free(source);
+		if (!same) fail(runtime, "getShaderSourceFromFile disagrees on shader " + std::to_string(i));
+
+		runtime.decodedBytes += expected[i].size();
+	}
+	runtime.decodeSeconds += elapsed.count();
+}
+
+// Compresses a corpus and packs it with and without the entropy code the decompressors were generated with,
+// checking the port of the decompressor and the generated ones give back every shader
+static void checkRuntimes(const std::unordered_map<std::string, std::string>& corpus) {
+	static const HuffmanCode code = runtimeEntropyCode();
+	static const HuffmanDecoder decoder = make_huffman_decoder(code);
+
+	static ThreadPool pool(1);
+	std::unordered_map<std::string, std::string> texts = corpus;
+	Tokens tokens = compress_texts(texts, 3, 0, pool, CompressionBudget{}, 1, false);
+	TokenExpansion expansion = expandTokens(tokens.token_char_map, tokens.token_list);
+
+	// The decompressors reject packs nesting tokens deeper than they were generated for
+	if (expansion.maxDepth > RUNTIME_MAX_TOKEN_DEPTH) return;
+
+	for (const HuffmanCode* entropyCode : {(const HuffmanCode*)nullptr, &code}) {
+		std::vector<std::pair<std::string, size_t>> shadersOffsets;
+		std::vector<size_t> shaderLengths;
+		std::vector<uint8_t> pack = generatePackedContent(texts, tokens.token_char_map, tokens.token_list, expansion, GLSL_VERSION, entropyCode, shadersOffsets, shaderLengths);
+
+		std::vector<std::string> expected;
+		for (const auto& [name, offset] : shadersOffsets) expected.push_back(GLSL_VERSION + "\n" + corpus.at(name));
+
+		Runtime& runtime = entropyCode ? entropyRuntime : plainRuntime;
+		if (unpack_shaders(pack, entropyCode ? &decoder : nullptr) != expected) fail(runtime, "unpack_shaders disagrees");
+		checkRuntime(runtime, pack, expected);
+	}
+}
+
+static void checkRoundTrip(const std::unordered_map<std::string, std::string>& corpus) {
+	checkCrusher(corpus);
+	checkRuntimes(corpus);
+	corpora++;
+}
+
+#ifdef GLSLCRUSHER_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	static bool registered = std::atexit(reportDecoding) == 0;
+	(void)registered;
+
+	checkRoundTrip(corpusFromBytes(data, size));
+	return 0;
+}
+
+#else
+
+// Without libFuzzer, runs the given number of random inputs of up to the given size
+int main(int argc, char** argv) {
+	size_t runs = (argc > 1) ? std::stoull(argv[1]) : 200;
+	size_t maxSize = (argc > 2) ? std::stoull(argv[2]) : 4096;
+
+	uint32_t seed = 12345;
+	auto next = [&]() {
+		seed = seed * 1664525u + 1013904223u;
+		return seed >> 8;
+	};
+
+	std::vector<uint8_t> input;
+	for (size_t run = 0; run < runs; run++) {
+		input.resize(next() % (maxSize + 1));
+		for (uint8_t& b : input) b = (uint8_t)next();
+		checkRoundTrip(corpusFromBytes(input.data(), input.size()));
+	}
+
+	reportDecoding();
+	return 0;
+}
+
+#endif
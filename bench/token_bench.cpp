@@ -0,0 +1,38 @@
+// Measures time and peak memory of find_best_token as the corpus grows
+#include "Token.h"
+#include "ShaderCorpus.h"
+#include "PeakMemory.h"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+int main(int argc, char** argv) {
+	size_t maxCorpusSize = (argc > 1) ? std::stoull(argv[1]) : (size_t)4 << 20;
+	size_t threads = (argc > 2) ? std::stoull(argv[2]) : 1;
+	const size_t shaderSize = 8 * 1024;
+	ThreadPool pool(threads);
+
+	std::cout << "corpus_bytes,shaders,seconds,peak_rss_kb,score" << std::endl;
+
+	for (size_t corpusSize = 16 * 1024; corpusSize <= maxCorpusSize; corpusSize *= 2) {
+		uint32_t seed = 12345;
+		std::unordered_map<std::string, std::string> texts;
+		size_t total = 0;
+		while (total < corpusSize) {
+			std::string shader = generateShader(seed, shaderSize);
+			total += shader.size();
+			texts["shader" + std::to_string(texts.size())] = std::move(shader);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		TokenInfo best = find_best_token(texts, false, 3, 0, pool);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		std::cout << total << "," << texts.size() << "," << elapsed.count() << "," << peakMemoryKB() << "," << best.score << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,240 @@
+// Measures the time to unpack every shader of a pack at boot, comparing the recursive decompressor
+// generated by previous versions with the entry points generated now
+#include "Token.h"
+#include "OutputGenerator.h"
+#include "ShaderCorpus.h"
+#include "GeneratedRuntime.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Port of the recursive decompressor, tokens are stored before the shaders and '$' escapes hold their offset
+namespace legacy {
+	struct Unpacker {
+		std::vector<const char*> tokens;
+		size_t maxOutputSize;
+		std::string version;
+	};
+
+	static size_t tknlen(const char* const token) {
+		size_t length = 0;
+		while (token[length]) {
+			if (token[length] == '$') {
+				length += 2;
+			}
+			length++;
+		}
+		return length;
+	}
+
+	static void decompress(const Unpacker& u, const char* const compressedText, const char* const token, size_t offset, char* decompressedText, size_t* write_pos) {
+		for (size_t readPos = offset; token[readPos] != '\0'; readPos++) {
+			unsigned char c = (unsigned char)token[readPos];
+
+			if (c == '$') {
+				uint16_t tokenOffset = (uint8_t)token[readPos + 1] | ((uint8_t)token[readPos + 2] << 8);
+				readPos += 2;
+
+				size_t tokenLength = tknlen(&compressedText[tokenOffset]);
+				if (*write_pos + tokenLength >= u.maxOutputSize) {
+					fprintf(stderr, "Error: Output buffer overflow\n");
+					return;
+				}
+
+				decompress(u, compressedText, &compressedText[tokenOffset], 0, decompressedText, write_pos);
+			}
+			else if (c >= 128) {
+				size_t tokenLength = tknlen(u.tokens[c - 128]);
+				if (*write_pos + tokenLength >= u.maxOutputSize) {
+					fprintf(stderr, "Error: Output buffer overflow\n");
+					return;
+				}
+
+				decompress(u, compressedText, u.tokens[c - 128], 0, decompressedText, write_pos);
+			}
+			else {
+				decompressedText[(*write_pos)++] = c;
+			}
+		}
+		decompressedText[*write_pos] = '\0';
+	}
+
+	static char* getShaderSourceFromFile(const Unpacker& u, const char* const compressedText, size_t offset) {
+		char* decompressedText = (char*)malloc(u.maxOutputSize + 1);
+		memcpy(decompressedText, u.version.c_str(), u.version.size() + 1);
+
+		size_t write_pos = u.version.size();
+		decompress(u, compressedText, compressedText, offset, decompressedText, &write_pos);
+		return decompressedText;
+	}
+
+	// Rewrites the '$' escapes of a text from token indices to token offsets
+	static bool rewriteEscapes(std::string& text, const std::vector<size_t>& tokenOffsets) {
+		for (size_t i = 0; i < text.size(); i++) {
+			if (text[i] != '$') continue;
+
+			size_t offset = tokenOffsets[(uint8_t)text[i + 1] | ((uint8_t)text[i + 2] << 8)];
+			if (offset > 0xFFFF) return false;
+			text[i + 1] = (char)(offset & 0xFF);
+			text[i + 2] = (char)((offset >> 8) & 0xFF);
+			i += 2;
+		}
+		return true;
+	}
+
+	// Builds the pack as previous versions wrote it, returns false if the tokens span more than 64KB
+	static bool buildPack(const Tokens& tokens, const std::vector<std::string>& shaders, std::string& pack, std::vector<size_t>& shaderOffsets) {
+		std::vector<size_t> tokenOffsets;
+		for (size_t i = 0; i < tokens.token_list.size(); i++) {
+			tokenOffsets.push_back(pack.size());
+			pack += tokens.token_list.at((uint16_t)i);
+			pack += '\0';
+		}
+		for (const std::string& shader : shaders) {
+			shaderOffsets.push_back(pack.size());
+			pack += shader;
+			pack += '\0';
+		}
+		return rewriteEscapes(pack, tokenOffsets);
+	}
+}
+
+// Runs a full unpack of the pack the given number of times, returning the seconds per full unpack
+template <typename Unpack>
+static double timeUnpack(size_t repeats, size_t& outputSize, Unpack unpack) {
+	auto start = std::chrono::steady_clock::now();
+	for (size_t r = 0; r < repeats; r++) {
+		outputSize = unpack();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / repeats;
+}
+
+int main(int argc, char** argv) {
+	size_t corpusSize = (argc > 1) ? std::stoull(argv[1]) : (size_t)1 << 20;
+	size_t repeats = (argc > 2) ? std::stoull(argv[2]) : 20;
+	const size_t shaderSize = 8 * 1024;
+	const std::string glslVersion = "#version 330 core";
+
+	uint32_t seed = 12345;
+	std::unordered_map<std::string, std::string> shaders;
+	size_t total = 0, longestShaderLength = 0;
+	while (total < corpusSize) {
+		std::string shader = generateShader(seed, shaderSize);
+		total += shader.size();
+		longestShaderLength = std::max(longestShaderLength, shader.size());
+		shaders["shader" + std::to_string(shaders.size()) + ".frag"] = std::move(shader);
+	}
+
+	ThreadPool pool(1);
+	Tokens tokens = compress_texts(shaders, 3, 0, pool, CompressionBudget{}, 1, false);
+	TokenExpansion expansion = expandTokens(tokens.token_char_map, tokens.token_list);
+
+	std::vector<std::pair<std::string, size_t>> shadersOffsets;
+	std::vector<size_t> shaderLengths;
+	std::vector<uint8_t> pack = generatePackedContent(shaders, tokens.token_char_map, tokens.token_list, expansion, glslVersion, nullptr, shadersOffsets, shaderLengths);
+
+	const char* text = (const char*)pack.data();
+	if (!generated::verifyShaderPack(text, pack.size())) {
+		std::cerr << "Invalid pack" << std::endl;
+		return 1;
+	}
+
+	size_t shaderCount = generated::getShaderCount(text);
+	size_t totalLength = generated::getShadersTotalLength(text);
+	std::vector<char> arena(totalLength);
+	std::vector<const char*> sources(shaderCount);
+
+	// Every entry point must produce the same sources
+	if (!generated::unpackAllShaders(text, arena.data(), arena.size(), sources.data())) {
+		std::cerr << "unpackAllShaders failed" << std::endl;
+		return 1;
+	}
+	for (size_t i = 0; i < shaderCount; i++) {
+		char* expected = generated::getShaderSourceFromFile(text, generated::getShaderOffset(text, i));
+		bool same = strcmp(expected, sources[i]) == 0 && strlen(expected) == generated::getShaderLength(text, i);
+		free(expected);
+		if (!same) {
+			std::cerr << "Entry points disagree on shader " << i << std::endl;
+			return 1;
+		}
+	}
+
+	std::cout << "decoder,corpus_bytes,shaders,pack_bytes,max_token_depth,seconds_per_unpack,mb_per_s" << std::endl;
+
+	size_t outputSize = 0;
+	auto report = [&](const char* decoder, double seconds) {
+		std::cout << decoder << "," << total << "," << shaderCount << "," << pack.size() << "," << expansion.maxDepth << ","
+			<< seconds << "," << outputSize / seconds / (1024 * 1024) << std::endl;
+	};
+
+	legacy::Unpacker legacyUnpacker;
+	for (size_t i = 128; i < 128 + expansion.charLengths.size(); i++) legacyUnpacker.tokens.push_back(tokens.token_char_map.at((uint8_t)i).c_str());
+	legacyUnpacker.maxOutputSize = longestShaderLength + glslVersion.size() + 2;
+	legacyUnpacker.version = glslVersion + "\n";
+
+	std::vector<std::string> orderedShaders;
+	for (const auto& [name, offset] : shadersOffsets) orderedShaders.push_back(shaders.at(name));
+
+	std::string legacyPack;
+	std::vector<size_t> legacyOffsets;
+	if (legacy::buildPack(tokens, orderedShaders, legacyPack, legacyOffsets)) {
+		for (size_t i = 0; i < shaderCount; i++) {
+			char* expected = legacy::getShaderSourceFromFile(legacyUnpacker, legacyPack.c_str(), legacyOffsets[i]);
+			bool same = strcmp(expected, sources[i]) == 0;
+			free(expected);
+			if (!same) {
+				std::cerr << "Decompressors disagree on shader " << i << std::endl;
+				return 1;
+			}
+		}
+
+		report("recursive", timeUnpack(repeats, outputSize, [&]() {
+			size_t size = 0;
+			for (size_t offset : legacyOffsets) {
+				char* source = legacy::getShaderSourceFromFile(legacyUnpacker, legacyPack.c_str(), offset);
+				size += strlen(source);
+				free(source);
+			}
+			return size;
+		}));
+	}
+	else {
+		std::cerr << "Tokens span more than 64KB, the recursive decompressor cannot address them" << std::endl;
+	}
+
+	report("getShaderSourceFromFile", timeUnpack(repeats, outputSize, [&]() {
+		size_t size = 0;
+		for (size_t i = 0; i < shaderCount; i++) {
+			char* source = generated::getShaderSourceFromFile(text, generated::getShaderOffset(text, i));
+			size += strlen(source);
+			free(source);
+		}
+		return size;
+	}));
+
+	report("unpackShader", timeUnpack(repeats, outputSize, [&]() {
+		size_t size = 0;
+		char* write = arena.data();
+		for (size_t i = 0; i < shaderCount; i++) {
+			size_t length = generated::getShaderLength(text, i);
+			size += generated::unpackShader(text, generated::getShaderOffset(text, i), write, length + 1);
+			write += length + 1;
+		}
+		return size;
+	}));
+
+	report("unpackAllShaders", timeUnpack(repeats, outputSize, [&]() {
+		generated::unpackAllShaders(text, arena.data(), arena.size(), sources.data());
+		return totalLength - shaderCount;
+	}));
+
+	return 0;
+}
@@ -1,30 +1,70 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
 #include <iostream>
+#include <new>
 
+#include "Crusher.h"
 #include "FileUtils.h"
-#include "ShaderUtils.h"
-#include "Token.h"
-#include "OutputGenerator.h"
+#include "FileWatcher.h"
+#include "Unpacker.h"
+
+// Allocations are only counted for the stats report, to keep worker threads from contending on the counter otherwise
+static bool countAllocations = false;
+
+void* operator new(size_t size) {
+	if (countAllocations) allocation_count.fetch_add(1, std::memory_order_relaxed);
+	if (void* memory = std::malloc(size ? size : 1)) return memory;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+	std::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+	std::free(memory);
+}
 
 // Function to parse command-line arguments
 void parseArguments(
 	int argc, char** argv,
 	std::string& outputPackFile, std::string& outputHeaderFile, std::string& outputCFile,
-	int& maxGLSLVersion, bool& useCoreVersion,
 	std::vector<std::string>& shaderFiles,
-	size_t& minTokenSize, size_t& maxTokenSize,
-	bool& verbose
+	CrusherOptions& options,
+	std::string& cachePath,
+	std::string& statsPath,
+	std::string& trainDictionaryPath,
+	std::string& dictionaryPath,
+	bool& watch
 ) {
 	if (argc < 2) {
-		throw std::runtime_error("Usage: " + std::string(argv[0]) + " <shader_file1> <shader_file2> ... [--min-token-size <size>] [--max-token-size <size>] [-p <pack_file> | --output-pack <pack_file>] [-h <header_file> | --output-header <header_file>] [-c <c_file> | --output-c <c_file>] [-v <version> | --glsl-version <version>] [--core | --no-core] [--verbose]");
+		throw std::runtime_error("Usage: " + std::string(argv[0]) + " <shader_file1> <shader_file2> ... [--min-token-size <size>] [--max-token-size <size>] [--threads <count>] [--time-budget <ms>] [--memory-budget <MB>] [--cache <path>] [--cache-threshold <percent>] [--train-dictionary <file>] [--dictionary <file>] [--search greedy|beam:<width>] [--entropy] [--embed] [--cached-accessor] [--verify] [--watch] [--stats-json <file>] [-p <pack_file> | --output-pack <pack_file>] [-h <header_file> | --output-header <header_file>] [-c <c_file> | --output-c <c_file>] [-v <version> | --glsl-version <version>] [--core | --no-core] [--verbose]");
 	}
 
 	for (int i = 1; i < argc; ++i) {
 		std::string arg = argv[i];
 		if ((arg == "--min-token-size") && i + 1 < argc) {
-			minTokenSize = std::stoull(argv[++i]);
+			options.minTokenSize = std::stoull(argv[++i]);
 		}
 		else if ((arg == "--max-token-size") && i + 1 < argc) {
-			maxTokenSize = std::stoull(argv[++i]);
+			options.maxTokenSize = std::stoull(argv[++i]);
+		}
+		else if ((arg == "--threads") && i + 1 < argc) {
+			options.threads = std::stoull(argv[++i]);
 		}
 		else if ((arg == "-p" || arg == "--output-pack") && i + 1 < argc) {
 			outputPackFile = argv[++i];
@@ -36,61 +76,157 @@ void parseArguments(
 			outputCFile = argv[++i];
 		}
 		else if ((arg == "-v" || arg == "--glsl-version") && i + 1 < argc) {
-			maxGLSLVersion = std::stoi(argv[++i]);
+			options.maxGLSLVersion = std::stoi(argv[++i]);
+		}
+		else if ((arg == "--time-budget") && i + 1 < argc) {
+			options.budget.time_ms = std::stoull(argv[++i]);
+		}
+		else if ((arg == "--memory-budget") && i + 1 < argc) {
+			options.budget.memory_bytes = std::stoull(argv[++i]) << 20;
+		}
+		else if ((arg == "--cache") && i + 1 < argc) {
+			cachePath = argv[++i];
+		}
+		else if ((arg == "--cache-threshold") && i + 1 < argc) {
+			options.dictionaryThresholdPercent = std::stod(argv[++i]);
+		}
+		else if ((arg == "--train-dictionary") && i + 1 < argc) {
+			trainDictionaryPath = argv[++i];
+		}
+		else if ((arg == "--dictionary") && i + 1 < argc) {
+			dictionaryPath = argv[++i];
+		}
+		else if ((arg == "--search") && i + 1 < argc) {
+			std::string search = argv[++i];
+			if (search == "greedy") {
+				options.beamWidth = 1;
+			}
+			else if (search.rfind("beam:", 0) == 0 && search.size() > 5 && search.find_first_not_of("0123456789", 5) == std::string::npos) {
+				options.beamWidth = std::max<size_t>(std::stoull(search.substr(5)), 1);
+			}
+			else {
+				throw std::runtime_error("Error: --search must be greedy or beam:<width>.");
+			}
+		}
+		else if ((arg == "--stats-json") && i + 1 < argc) {
+			statsPath = argv[++i];
+		}
+		else if (arg == "--embed") {
+			options.embed = true;
+		}
+		else if (arg == "--cached-accessor") {
+			options.cachedAccessor = true;
+		}
+		else if (arg == "--entropy") {
+			options.entropy = true;
+		}
+		else if (arg == "--verify") {
+			options.verify = true;
+		}
+		else if (arg == "--watch") {
+			watch = true;
 		}
 		else if (arg == "--core") {
-			useCoreVersion = true;
+			options.useCoreVersion = true;
 		}
 		else if (arg == "--no-core") {
-			useCoreVersion = false;
+			options.useCoreVersion = false;
 		}
 		else if (arg == "--verbose") {
-			verbose = true;
+			options.verbose = true;
 		}
 		else {
 			shaderFiles.push_back(arg);
 		}
 	}
 
-	if (maxTokenSize != 0 && maxTokenSize < minTokenSize) {
+	if (options.maxTokenSize != 0 && options.maxTokenSize < options.minTokenSize) {
 		throw std::runtime_error("Error: --max-token-size must be greater than or equal to --min-token-size.");
 	}
 
+	if (!trainDictionaryPath.empty() && (!dictionaryPath.empty() || !cachePath.empty() || watch)) {
+		throw std::runtime_error("Error: --train-dictionary cannot be used with --dictionary, --cache or --watch.");
+	}
+
+	if (!dictionaryPath.empty() && !cachePath.empty()) {
+		throw std::runtime_error("Error: --dictionary cannot be used with --cache.");
+	}
+
 	if (shaderFiles.empty()) {
 		throw std::runtime_error("Error: No shader files provided.");
 	}
 }
 
-// Function to process shaders and extract relevant information
-void processShaders(
-	const std::vector<std::string>& shaderFiles,
-	int maxGLSLVersion,
-	std::unordered_map<std::string, std::string>& shaders,
-	std::unordered_map<std::string, std::string>& globalUniformMap,
-	std::unordered_map<std::string, std::string>& globalInOutMap,
-	int& highestGLSLVersion,
-	bool verbose
-) {
-	for (const auto& filePath : shaderFiles) {
-		std::string shaderCode = readFile(filePath);
+// Function to report what staying within the budget cost
+void reportBudget(const CompressionBudget& budget, const Tokens& tokens) {
+	size_t tokenCount = tokens.token_char_map.size() + tokens.token_list.size();
+	const CompressionStats& stats = tokens.stats;
 
-		if (verbose) {
-			std::cout << "Processing shader: " << filePath << "\n";
-		}
+	if (budget.time_ms > 0 && stats.time_budget_reached) {
+		std::cout << "Time budget reached after " << tokenCount << " tokens, the next token would have saved "
+			<< stats.next_token_score << " more bytes." << std::endl;
+	}
+	else if (budget.time_ms > 0) {
+		std::cout << "Compression finished within the time budget." << std::endl;
+	}
 
-		// Extract and validate version
-		int shaderVersion = extractGLSLVersion(shaderCode);
-		if (shaderVersion > 0) {
-			highestGLSLVersion = std::max(highestGLSLVersion, shaderVersion);
-			if (maxGLSLVersion > 0 && shaderVersion > maxGLSLVersion) {
-				throw std::runtime_error("Error: Shader " + filePath + " uses GLSL version " + std::to_string(shaderVersion) + ", which exceeds the specified maximum version " + std::to_string(maxGLSLVersion) + ".");
-			}
+	if (budget.memory_bytes > 0 && (stats.indexed_fraction < 1.0 || stats.dropped_candidates > 0)) {
+		std::cout << "Memory budget reached, tokens were searched in " << std::fixed << std::setprecision(1)
+			<< 100.0 * stats.indexed_fraction << "% of the texts at least, dropping " << stats.dropped_candidates
+			<< " candidate tokens." << std::endl;
+	}
+	else if (budget.memory_bytes > 0) {
+		std::cout << "Compression finished within the memory budget." << std::endl;
+	}
+}
+
+// Function to report how well the cached dictionary still compresses the shaders, and whether tokens were searched again
+void reportDictionaryCache(const DictionaryCacheStats& stats, const CrusherOptions& options) {
+	if (stats.reused) {
+		std::cout << "Dictionary cache: " << stats.encoded << " of " << stats.texts << " shaders encoded, compression ratio "
+			<< std::fixed << std::setprecision(2) << 100.0 * stats.ratio << "% (" << 100.0 * stats.cached_ratio << "% when the dictionary was found)" << std::endl;
+		if (stats.searched) {
+			std::cout << "Dictionary cache: compression ratio dropped by more than " << options.dictionaryThresholdPercent << "%, searching tokens again." << std::endl;
 		}
+	}
+	else if (options.verbose) {
+		std::cout << "Dictionary cache: no usable dictionary" << std::endl;
+	}
+}
 
-		removeGLSLVersionDirective(shaderCode);
+// Function to report the size the beam search saves over the greedy search, packing the shaders again greedily.
+// Watched shaders are read rather than mapped, like for the builds.
+void reportSearchGain(const CrusherOptions& options, const std::vector<std::string>& shaderFiles, size_t packSize, bool watch) {
+	CrusherOptions greedyOptions = options;
+	greedyOptions.beamWidth = 1;
+	greedyOptions.reuseDictionary = false;
+	greedyOptions.verbose = false;
 
-		shaders[filePath] = extractExternals(shaderCode, globalUniformMap, globalInOutMap, verbose);
+	Crusher greedy(greedyOptions);
+	for (const std::string& filePath : shaderFiles) {
+		MappedFile file(filePath, !watch);
+		greedy.setShader(filePath, file.view());
 	}
+	size_t greedySize = greedy.crush().pack.size();
+
+	long long difference = (long long)packSize - (long long)greedySize;
+	std::cout << "Beam search: " << greedySize << " -> " << packSize << " bytes (" << std::showpos << difference << " bytes, "
+		<< std::fixed << std::setprecision(2) << 100.0 * difference / std::max<size_t>(greedySize, 1) << std::noshowpos << "%) compared with the greedy search." << std::endl;
+}
+
+// Function to measure the unpacking throughput of a pack in MB/s, unpacking it for at least a tenth of a second
+double measureUnpacking(const std::vector<uint8_t>& pack, const HuffmanDecoder* decoder) {
+	using Clock = std::chrono::steady_clock;
+
+	size_t bytes = 0;
+	Clock::time_point start = Clock::now();
+	std::chrono::duration<double> elapsed{};
+	do {
+		for (const std::string& source : unpack_shaders(pack, decoder)) bytes += source.size();
+		elapsed = Clock::now() - start;
+	} while (elapsed.count() < 0.1);
+
+	return bytes / elapsed.count() / 1e6;
 }
 
 int main(int argc, char** argv) {
@@ -98,63 +234,148 @@ int main(int argc, char** argv) {
 		std::string outputPackFile = "shaders.pack";
 		std::string outputHeaderFile = "unpacker.h";
 		std::string outputCFile = "unpacker.c";
-		int maxGLSLVersion = 0; // 0 means auto-detect the highest version
 		std::vector<std::string> shaderFiles;
-		bool useCoreVersion = true;
-		bool verbose = false;
-		size_t minTokenSize = 3;
-		size_t maxTokenSize = 0;
+		CrusherOptions options;
+		std::string cachePath;
+		std::string statsPath;
+		std::string trainDictionaryPath;
+		std::string dictionaryPath;
+		bool watch = false;
 
 		// Parse command-line arguments
-		parseArguments(argc, argv, outputPackFile, outputHeaderFile, outputCFile, maxGLSLVersion, useCoreVersion, shaderFiles, minTokenSize, maxTokenSize, verbose);
+		parseArguments(argc, argv, outputPackFile, outputHeaderFile, outputCFile, shaderFiles, options, cachePath, statsPath, trainDictionaryPath, dictionaryPath, watch);
+		countAllocations = !statsPath.empty();
 
-		std::unordered_map<std::string, std::string> shaders;
-		std::unordered_map<std::string, std::string> globalUniformMap;
-		std::unordered_map<std::string, std::string> globalInOutMap;
-		int highestGLSLVersion = 0;
+		// The dictionary is kept in memory between builds when watching, and in the cache file if there is one
+		options.reuseDictionary = watch || !cachePath.empty();
+		Crusher crusher(options);
+		if (!cachePath.empty()) {
+			DictionaryCache dictionary;
+			if (load_dictionary_cache(cachePath, dictionary)) crusher.setDictionary(std::move(dictionary));
+		}
+		if (!dictionaryPath.empty()) {
+			crusher.setSharedDictionary(load_shared_dictionary(dictionaryPath));
+		}
 
-		// Process shaders
-		processShaders(shaderFiles, maxGLSLVersion, shaders, globalUniformMap, globalInOutMap, highestGLSLVersion, verbose);
+		// Shaders are mapped and copied once into the Crusher, which validates them in parallel. Reading is timed here as the Crusher only times their processing.
+		// Watched shaders are read instead, as an editor may truncate one while it is mapped.
+		std::vector<PhaseStats> readPhases;
+		auto setShaders = [&](const std::vector<std::string>& filePaths) {
+			PhaseTimer readPhase(readPhases, "read");
+			std::vector<MappedFile> files;
+			files.reserve(filePaths.size());
+			for (const std::string& filePath : filePaths) files.emplace_back(filePath, !watch);
 
-		// Determine the GLSL version to use
-		if (maxGLSLVersion == 0) maxGLSLVersion = highestGLSLVersion;
+			for (size_t i = 0; i < filePaths.size(); i++) {
+				crusher.setShader(filePaths[i], files[i].view());
+			}
+		};
 
-		if (verbose) {
-			std::cout << "Highest GLSL version detected: " << highestGLSLVersion << std::endl;
-			std::cout << "Using GLSL version: " << maxGLSLVersion << std::endl;
-		}
+		setShaders(shaderFiles);
 
-		// Calculate the length of the longest shader
-		size_t longestShaderLength = 0;
-		for (const auto& shader : shaders) {
-			longestShaderLength = std::max(longestShaderLength, shader.second.length());
+		// Training only writes the dictionary found for the shaders, for other packs to be encoded with
+		if (!trainDictionaryPath.empty()) {
+			CrusherResult result = crusher.crush();
+			reportBudget(options.budget, result.tokens);
+			save_shared_dictionary(trainDictionaryPath, {result.tokens, crusher.uniformNames(), crusher.inOutNames()});
+			std::cout << "Dictionary of " << result.tokens.token_char_map.size() + result.tokens.token_list.size() << " tokens trained on "
+				<< shaderFiles.size() << " shaders written to " << trainDictionaryPath << "." << std::endl;
+			return 0;
 		}
 
-		Tokens tokens = compress_texts(shaders, minTokenSize, maxTokenSize, verbose);
+		std::string previousHeader;
+		std::string previousCFile;
 
-		// Pass the GLSL version to the header generator
-		std::string glslVersionDirective = "#version " + std::to_string(maxGLSLVersion) + (useCoreVersion ? " core" : "");
-		std::vector<std::pair<std::string, size_t>> shadersOffsets;
+		// Compresses the shaders and writes the outputs, the header and C file only when they changed
+		auto build = [&](bool firstBuild) {
+			CrusherResult result = crusher.crush();
+			reportBudget(options.budget, result.tokens);
 
-		// Generate the packed content for shaders and write it to the specified file
-		std::vector<uint8_t> packedContent = generatePackedContent(shaders, tokens.token_list, shadersOffsets);
-		writeFile(outputPackFile, packedContent);
-		if (verbose) {
-			std::cout << outputPackFile << " generated with size: " << packedContent.size() << " bytes." << std::endl;
-		}
+			if (result.dictionaryStats) {
+				reportDictionaryCache(*result.dictionaryStats, options);
+			}
 
-		// Generate the header content and write it to the specified file
-		std::string header = generateHeader(globalUniformMap, shadersOffsets);
-		writeFile(outputHeaderFile, header);
-		if (verbose) {
-			std::cout << outputHeaderFile << " generated." << std::endl;
-		}
+			if (result.dictionaryUpdated && !cachePath.empty()) {
+				save_dictionary_cache(cachePath, crusher.dictionary());
+			}
 
-		// Generate the C file content and write it to the specified file
-		std::string cFileContent = generateCFile(tokens.token_char_map, globalUniformMap, glslVersionDirective, longestShaderLength);
-		writeFile(outputCFile, cFileContent);
-		if (verbose) {
-			std::cout << outputCFile << " generated." << std::endl;
+			if (!statsPath.empty()) {
+				result.stats.phases.insert(result.stats.phases.begin(), readPhases.begin(), readPhases.end());
+				writeFile(statsPath, generateStatsJSON(result.stats));
+			}
+			readPhases.clear();
+
+			if (options.beamWidth > 1 && dictionaryPath.empty() && firstBuild) {
+				reportSearchGain(options, shaderFiles, result.pack.size(), watch);
+			}
+
+			// Report what entropy coding saves and what it costs to unpack
+			if (result.entropyCode && firstBuild) {
+				HuffmanDecoder decoder = make_huffman_decoder(*result.entropyCode);
+				double plainSpeed = measureUnpacking(result.plainPack, nullptr);
+				double entropySpeed = measureUnpacking(result.pack, &decoder);
+				std::cout << "Entropy coding: " << result.plainPack.size() << " -> " << result.pack.size() << " bytes ("
+					<< std::fixed << std::setprecision(1) << 100.0 * result.pack.size() / result.plainPack.size() << "%), unpacking "
+					<< plainSpeed << " -> " << entropySpeed << " MB/s" << std::endl;
+			}
+
+			// Every build checks the pack, the first one also reports how fast it unpacks
+			if (options.verify && firstBuild) {
+				HuffmanDecoder decoder;
+				if (result.entropyCode) decoder = make_huffman_decoder(*result.entropyCode);
+				double speed = measureUnpacking(result.pack, result.entropyCode ? &decoder : nullptr);
+				std::cout << "Verification: " << result.stats.shaders.size() << " shaders unpack to their renamed sources, at "
+					<< std::fixed << std::setprecision(1) << speed << " MB/s" << std::endl;
+			}
+
+			// Write the pack, replaced at once like every output for applications reloading it, unless it is in the C file
+			if (!options.embed) {
+				writeFile(outputPackFile, result.pack);
+				if (options.verbose) {
+					std::cout << outputPackFile << " generated with size: " << result.pack.size() << " bytes." << std::endl;
+				}
+			}
+
+			if (firstBuild || result.header != previousHeader) {
+				writeFile(outputHeaderFile, result.header);
+				previousHeader = std::move(result.header);
+				if (options.verbose) {
+					std::cout << outputHeaderFile << " generated." << std::endl;
+				}
+			}
+
+			if (firstBuild || result.cFile != previousCFile) {
+				writeFile(outputCFile, result.cFile);
+				previousCFile = std::move(result.cFile);
+				if (options.verbose) {
+					std::cout << outputCFile << " generated." << std::endl;
+				}
+			}
+		};
+
+		build(true);
+
+		// Rebuild as shaders change, only processing the changed ones and reusing the dictionary
+		if (watch) {
+			FileWatcher watcher(shaderFiles);
+			std::cout << "Watching " << shaderFiles.size() << " shaders for changes." << std::endl;
+
+			while (true) {
+				std::vector<std::string> changed = watcher.wait();
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+				try {
+					setShaders(changed);
+					build(false);
+
+					std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+					std::cout << "Rebuilt " << outputPackFile << " after changes to " << changed.size() << " shaders in "
+						<< std::fixed << std::setprecision(1) << elapsed.count() << " ms." << std::endl;
+				} catch (const std::exception& e) {
+					// Keep watching, the shader may be fixed by its next change
+					std::cerr << e.what() << std::endl;
+				}
+			}
 		}
 	} catch (const std::exception& e) {
 		std::cerr << e.what() << std::endl;